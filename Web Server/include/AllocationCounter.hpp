@@ -0,0 +1,17 @@
+#ifndef CS252_ALLOCATIONCOUNTER_H
+#define CS252_ALLOCATIONCOUNTER_H
+
+/**
+ * Counts the heap allocations made by the calling thread, to see what serving a request costs.
+ * Counting replaces the global operator new, so it is only compiled in with
+ * `make DFLAG="-DCOUNT_ALLOCATIONS"`. Otherwise allocations() is always 0.
+**/
+#ifdef COUNT_ALLOCATIONS
+static bool const counting_allocations = true;
+#else
+static bool const counting_allocations = false;
+#endif
+
+unsigned long allocations() noexcept;
+
+#endif
@@ -12,18 +12,115 @@ private:
      * This function is useful because 
     **/
     void set_opt(int shortopt, char const* optarg);
+
+    /**
+     * Parses a timeout in seconds for the given phase, throwing a ConfigError if it is out of range.
+    **/
+    static int parse_timeout(char const* optarg, std::string const& phase);
+
+    /**
+     * Values for options that only have a long form, kept clear of every short option character.
+    **/
+    enum LongOption { LO_REUSEPORT = 256, LO_KEEPALIVE_TIMEOUT, LO_MAX_REQUESTS, LO_HEADER_TIMEOUT, LO_BODY_TIMEOUT, LO_WRITE_TIMEOUT,
+                      LO_QUEUE_CAPACITY, LO_ACCEPTORS, LO_STATS, LO_WORKER_REQUESTS, LO_HANDOFF,
+                      LO_MAX_BODY, LO_UPLOAD_DIR, LO_MIME_TYPES,
+                      LO_FILE_CACHE, LO_MMAP_FILES, LO_OPEN_FILES, LO_OPEN_FILE_TTL };
 public:
     // Each mode is set to the same value as its flag, which can be useful while parsing arguments
-    enum Mode { SM_FORK = 'F', SM_LINEAR = 'L', SM_POOLTHREAD = 'P', SM_REQUESTTHREAD = 'R' };
+    enum Mode { SM_FORK = 'F', SM_LINEAR = 'L', SM_POOLTHREAD = 'P', SM_REQUESTTHREAD = 'R', SM_EVENTLOOP = 'E', SM_IOURING = 'U',
+                SM_PREFORK = 'W' };
 
     enum Mode mode = SM_LINEAR;
     bool verbose = false;
     unsigned short port = 0;
     int threads = -1;
+    int workers = -1;
     unsigned short queue_length = 5;
     std::string exec_dir = "script";
     std::string static_dir = "static";
 
+    /**
+     * Give every worker its own SO_REUSEPORT listener on a CPU of its own
+     * instead of having them all accept() on one socket.
+    **/
+    bool reuseport = false;
+
+    /**
+     * Pre-forked workers (-W) exit once they have served this many requests and the
+     * supervisor forks a fresh one in their place. Workers are never recycled at 0.
+    **/
+    int worker_requests = 0;
+
+    /**
+     * Pre-forked workers do not accept() themselves. One acceptor hands every connection to
+     * whichever worker has the fewest connections in flight.
+    **/
+    bool handoff = false;
+
+    /**
+     * The pool of threads (-P) without --reuseport: how many accepted connections may wait
+     * for a worker, how many threads accept them, and how often (in seconds) to print
+     * per-worker queue wait and service times. Stats are off at 0.
+    **/
+    int queue_capacity = 1024;
+    int acceptors = 1;
+    int stats_interval = 0;
+
+    /**
+     * How many seconds a kept-alive connection may sit idle between requests,
+     * and how many requests it may carry before the server closes it.
+     * A limit of 1 turns keep-alive off.
+    **/
+    int keep_alive_timeout = 5;
+    int max_requests = 100;
+
+    /**
+     * Deadlines in seconds for the other phases of a connection, so that slow or silent
+     * clients can not hold on to a worker. A client gets header_timeout to send a whole
+     * request head and body_timeout for the body that follows. While a response is being
+     * written, the client has to take some of it every write_timeout.
+    **/
+    int header_timeout = 10;
+    int body_timeout = 30;
+    int write_timeout = 30;
+
+    /**
+     * The largest request body in bytes the server accepts, whether it comes with a
+     * Content-Length or in chunks. Larger ones are answered with 403 Forbidden.
+    **/
+    long max_body = 4096;
+
+    /**
+     * Where the files uploaded with multipart/form-data bodies are written while their
+     * request is handled. They are removed once it is answered.
+    **/
+    std::string upload_dir = "/tmp";
+
+    /**
+     * A mime.types file whose types are used for file extensions before the ones the
+     * server knows itself (see MimeTypes). It is fine for it not to exist.
+    **/
+    std::string mime_types = "/etc/mime.types";
+
+    /**
+     * How many bytes of static files may be kept in memory (see FileCache), 0 for none.
+     * Process-per-request mode (-F) never caches, its processes do not live long enough.
+    **/
+    long file_cache = 32 << 20;
+
+    /**
+     * How many of the static files too large for the file cache may stay mapped into
+     * memory (see MappedFiles), 0 for none. -F never maps them either.
+    **/
+    int mmap_files = 64;
+
+    /**
+     * How many requested static paths, with their open descriptors, are remembered and for
+     * how many seconds (see OpenFileCache). 0 files remembers none. -F never does.
+    **/
+    int open_files = 256;
+    int open_file_ttl = 60;
+
     /**
      * You should not have to change this method, as it prints out
      * config options in a standard way that we parse in the step 1 tests
@@ -2,6 +2,7 @@
 #define CS252_CONTROLLER_H
 
 #include <string>
+#include <string_view>
 
 #include "Config.hpp"
 #include "server/Request.hpp"
@@ -36,8 +37,10 @@ public:
      * a string to store the final result in.
      * This can be used for both the SendFileController and for the ExecScriptController.
      * Make sure you use realpath() properly to make sure that requests do not traverse across your filesystem!
+     * When it returns false, errno is EACCES if the server may not look at the path, ENOENT if there is
+     * nothing there or it is outside of basedir, or whatever else realpath() ran into.
     **/
-    bool resolve_requested_path(std::string const& requested, std::string const& basedir, std::string& resolved) const noexcept;
+    bool resolve_requested_path(std::string_view requested, std::string const& basedir, std::string& resolved) const noexcept;
 
     /**
      * These static methods are conveniences that can be used whenever we need to send a basic error response.
@@ -1,8 +1,9 @@
 #ifndef CS252_EXECSCRIPTCONTROLLER_H
 #define CS252_EXECSCRIPTCONTROLLER_H
 
+#include <memory>
 #include <string>
-#include <fstream>
+#include <vector>
 
 #include "Config.hpp"
 #include "controller/Controller.hpp"
@@ -11,6 +12,27 @@
 
 class ExecScriptController : public Controller
 {
+public:
+    /**
+     * A script to run for a request. It holds everything the script needs, taken out of the
+     * request, so that it can run after the request is gone and on another thread (see
+     * Server::serve_buffered()), and what the script wrote once it has run.
+     * The files uploaded with the request are removed when the Script is destroyed.
+    **/
+    struct Script
+    {
+        std::string path;
+        std::string resolved;
+        std::vector<std::string> env;
+        std::vector<std::string> uploads;
+        std::string output;
+        bool ok = false;
+
+        Script() = default;
+        Script(Script const&) = delete;
+        Script& operator=(Script const&) = delete;
+        ~Script();
+    };
 private:
     /**
      * m_ignore's purpose is that when we request, say, GET /script/echo.sh, we actually want
@@ -22,37 +44,47 @@ private:
     std::string m_ignore;
 
     /**
-     * :: TODO ::
-     * Helper function to set all of the correct environment variables for the child process
+     * Helper function to put together the environment of the child process as "NAME=value" strings:
+     * the server's own, followed by HTTP:METHOD, HTTP:PATH, and HTTP:HEADER:, HTTP:QUERY: and HTTP:BODY:
+     * followed by each name, as well as HTTP:FILE:<field> with where each uploaded file was saved.
+     * It is built before forking, since a child of a threaded server may only exec.
     **/
-    bool set_environment(Request const& req) const noexcept;
+    void set_environment(Request const& req, std::vector<std::string>& env) const;
 
-  /**                                                                                                                                                                           
-   * Gets the content type of a given filename.                                                                                                                                 
-   * Whatever this returns can be used when setting the Content-Type header.                                                                                                    
-   * In order to do this, you need to call the `xdg-mime` command by fork()ing,                                                                                                 
-   * exec()ing, and then reading its output through a pipe, similar to lab 3.                                                                                                   
-   * Luckily for you, we have given you this code.                                                                                                                              
-   * Use it wisely.                                                                                                                                                             
-   **/
-  std::string get_content_type(std::string const& filename, Request const& req) const;
-
-  bool set_var(std::unordered_map<std::string, std::string> mapping, std::string key) const;
-  int get_content_length(std::fstream& fs) const;
+  void set_var(Request::Table const& mapping, std::string key, std::vector<std::string>& env) const;
+  void set_var(HeaderTable const& headers, std::string key, std::vector<std::string>& env) const;
 public:
     /**
      * Constructs an ExecScriptController with the given config and ignore path.
     **/
     ExecScriptController(Config const& config, std::string const& ignore);
-    
+
     /**
-     * :: TODO ::
-     * When the ExecScriptController runs, it should attempt to execute the requested file.
-     * Controller::resolve_requested_path should be used to validate and load the path of the file.
-     * We always need to exec in a child process and read the output back when the child has finished.
-     * Before execing, make sure to set up the scripts environment properly.
+     * When the ExecScriptController runs, it executes the requested file: prepare(), execute()
+     * and respond() one after the other. The event loops call the three themselves so that
+     * they can run the script on a thread of its own.
     **/
     void run(Request const& req, Response& res) const override;
+
+    /**
+     * Controller::resolve_requested_path is used to validate and load the path of the file,
+     * and only then is the body read and any uploads saved. Returns the Script to run, or
+     * nullptr if res has already been answered with an error.
+    **/
+    std::unique_ptr<Script> prepare(Request const& req, Response& res) const;
+
+    /**
+     * The script is exec'd in a child process and its output read back until the child has
+     * finished. It gets write_timeout seconds for that and can write at most a few megabytes,
+     * otherwise it is killed and fails. Touches nothing but script, so any thread can call it.
+    **/
+    void execute(Script& script) const;
+
+    /**
+     * Scripts write a whole response; its status line is replaced by one in the request's version.
+     * A script that failed or wrote something else is answered with 500 Internal Server Error.
+    **/
+    void respond(Script const& script, Response& res) const;
 };
 
 #endif
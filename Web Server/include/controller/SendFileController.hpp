@@ -2,32 +2,49 @@
 #define CS252_SENDFILECONTROLLER_H
 
 #include <string>
-#include <fstream>
+#include <string_view>
+#include <ctime>
+#include <memory>
 
 #include "Config.hpp"
 #include "controller/Controller.hpp"
 #include "server/Request.hpp"
 #include "server/Response.hpp"
+#include "server/DirWatcher.hpp"
+#include "server/OpenFileCache.hpp"
+#include "server/FileCache.hpp"
+#include "server/MappedFiles.hpp"
 
 class SendFileController : public Controller
 {
 private:
+    // follows static_dir for the caches, which all lock themselves
+    std::unique_ptr<DirWatcher> m_watcher;
+    // what requested paths resolve to, with open descriptors
+    std::unique_ptr<OpenFileCache> m_open_files;
+    // small files are answered from here
+    std::unique_ptr<FileCache> m_cache;
+    // larger ones from a shared mapping
+    std::unique_ptr<MappedFiles> m_mappings;
+
     /**
-     * :: TODO ::
-     * Gets the content length of a filestream.
-     * Whatever this returns can be used when setting the Content-Length header.
+     * The file requested names below static_dir, from m_open_files if it is there,
+     * otherwise resolved, opened and remembered, including when there is nothing there.
+     * Returns nullptr if the server is not allowed to look at it, which is not remembered,
+     * and throws a ControllerError if it could not be opened for any other reason.
     **/
-    int get_content_length(std::fstream& fs) const;
+    std::shared_ptr<OpenFileCache::File const> open_file(std::string_view requested) const;
 
     /**
-     * Gets the content type of a given filename.
-     * Whatever this returns can be used when setting the Content-Type header.
-     * In order to do this, you need to call the `xdg-mime` command by fork()ing,
-     * exec()ing, and then reading its output through a pipe, similar to lab 3.
-     * Luckily for you, we have given you this code.
-     * Use it wisely.
+     * Checks the conditional headers of req against the validators of the file and answers
+     * with 304 Not Modified or 412 Precondition Failed if they call for it. Returns whether
+     * it did, otherwise the file still has to be sent.
     **/
-    std::string get_content_type(std::string const& filename) const;
+    bool answer_conditional(Request const& req, Response& res, std::string_view etag,
+                            std::string_view last_modified, time_t mtime) const;
+
+    void send_cached(Response& res, FileCache::Entry const& entry) const;
+    void send_mapped(Response& res, std::shared_ptr<MappedFiles::Mapping const> mapping, std::string_view type) const;
 public:
     /**
      * Initializes the SendFileController with the given config.
@@ -35,14 +52,17 @@ public:
     SendFileController(Config const& config);
 
     /**
-     * :: TODO ::
-     * Looks at the path in req and tries to open it, read its contents, and send
-     * its contents using res.send()
-     * To figure out exactly what file to open, consider implementing the logic in
-     * Controller::resolve_requested_path() so that you can use the same logic for
-     * the extra credit portion of the lab.
+     * Looks at the path in req and tries to open it, which repeated requests find in the
+     * OpenFileCache. Controller::resolve_requested_path() keeps requests inside static_dir.
+     * Files small enough for the FileCache are read into it the first time and sent
+     * from memory after that, larger ones are mapped (see MappedFiles) and sent from the
+     * mapping. Only when neither works does the body go out with res.send_file().
+     * Every response carries an ETag and Last-Modified, and conditional requests whose
+     * copy is still current get 304 Not Modified without a body.
     **/
     void run(Request const& req, Response& res) const override;
+
+    FileCache const& cache() const noexcept;
 };
 
 #endif
\ No newline at end of file
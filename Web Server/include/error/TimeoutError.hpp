@@ -0,0 +1,18 @@
+#ifndef CS252_TIMEOUTERROR_H
+#define CS252_TIMEOUTERROR_H
+
+#include <string>
+
+#include "error/ConnectionError.hpp"
+
+/**
+ * TimeoutErrors are ConnectionErrors for clients that took too long -- to send a request,
+ * or to take a response off our hands. The connection is closed without an answer.
+**/
+class TimeoutError : public ConnectionError {
+public:
+    explicit TimeoutError(std::string const& what) : ConnectionError(what) { }
+    explicit TimeoutError(char const* what) : ConnectionError(what) { }
+};
+
+#endif
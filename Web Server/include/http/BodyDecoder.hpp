@@ -0,0 +1,79 @@
+#ifndef CS252_BODYDECODER_H
+#define CS252_BODYDECODER_H
+
+#include <cstddef>
+#include <string_view>
+
+#include "http/HttpStatus.hpp"
+
+/**
+ * Takes the framing off a request body, which either has a Content-Length or comes in
+ * chunks (Transfer-Encoding: chunked). Like HttpParser it works on whatever bytes have
+ * arrived, never copies and can stop and pick up again at any byte, so the same decoder
+ * serves handlers that pull a body as they go and event loops that set it aside as it
+ * arrives.
+ *
+ * Problems are reported by the result of decode() and error(), never by throwing.
+**/
+class BodyDecoder
+{
+public:
+    enum Result { BODY_INCOMPLETE, BODY_DONE, BODY_ERROR };
+
+    BodyDecoder();
+
+    /**
+     * Forgets the current body. Until one of the expect_ methods is called again,
+     * started() is false.
+    **/
+    void reset() noexcept;
+
+    /**
+     * What comes next: nothing, length bytes, or chunks adding up to at most max_size bytes.
+    **/
+    void expect_none() noexcept;
+    void expect_length(size_t length) noexcept;
+    void expect_chunked(size_t max_size) noexcept;
+
+    /**
+     * Gives up on the body with the given status, for problems found before decoding starts.
+    **/
+    void fail(HttpStatus const& status, char const* text) noexcept;
+
+    /**
+     * Decodes from the start of data, which holds the bytes that follow what earlier calls
+     * used up. used is set to how many bytes of data this call used up and piece to the body
+     * bytes among them, at most want of them. Every call hands out at most one piece, so
+     * callers loop until the result is not BODY_INCOMPLETE or nothing was used.
+    **/
+    Result decode(char const* data, size_t size, size_t want, size_t& used, std::string_view& piece) noexcept;
+
+    bool started() const noexcept;
+    bool done() const noexcept;
+    bool failed() const noexcept;
+
+    /**
+     * After BODY_ERROR: the status to answer with and what went wrong, for the logs.
+    **/
+    HttpStatus const& error() const noexcept;
+    char const* error_text() const noexcept;
+private:
+    enum State { STATE_IDLE, STATE_LENGTH, STATE_CHUNK_SIZE, STATE_CHUNK_DATA, STATE_CHUNK_END,
+                 STATE_TRAILERS, STATE_DONE, STATE_ERROR };
+
+    // chunk size lines and trailers longer than this are an error
+    static size_t const m_max_line = 1024;
+
+    State m_state;
+    size_t m_remaining;
+    size_t m_max_size;
+    size_t m_decoded;
+
+    HttpStatus const* m_error;
+    char const* m_error_text;
+
+    Result fail_with(HttpStatus const& status, char const* text) noexcept;
+    Result decode_line(std::string_view line) noexcept;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CS252_CHARSCAN_H
+#define CS252_CHARSCAN_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Vectorised scans over the bytes of a request, for the loops the parser spends its time in.
+ * Each scan measures how many leading bytes belong to a set of characters, which finds the
+ * next delimiter and checks everything before it in the same pass.
+ *
+ * The sets are classified with two table lookups per byte, one on its low and one on its
+ * high nibble, so the same code works for every set and 16 (SSE4.2) or 32 (AVX2) bytes are
+ * looked at per step. Which version runs is decided once at startup from what the CPU
+ * supports, with a plain table lookup per byte as the fallback.
+**/
+class CharScan
+{
+public:
+    /**
+     * A set of bytes. For ASCII, bit h of low[l] says whether the byte 0xhl is in it,
+     * bytes from 0x80 up are either all in (high) or all out.
+    **/
+    struct Set
+    {
+        uint8_t low[16];
+        bool high;
+    };
+
+    /**
+     * tchar from RFC 7230: what methods and header names are made of.
+    **/
+    static Set const token;
+
+    /**
+     * What may appear in a header value: visible characters, spaces, tabs and obs-text.
+    **/
+    static Set const field;
+
+    /**
+     * What may appear in a request-target: visible characters and obs-text, so it ends at a space.
+    **/
+    static Set const target;
+
+    /**
+     * Bytes of a query string that stand for themselves, so everything but & = % and +.
+    **/
+    static Set const query_plain;
+
+    /**
+     * How many bytes from the start of data are in set. Returns size if all of them are.
+    **/
+    static size_t span(char const* data, size_t size, Set const& set) noexcept;
+
+    /**
+     * Which version of span() this CPU runs: "avx2", "sse4.2" or "scalar".
+    **/
+    static char const* implementation() noexcept;
+};
+
+#endif
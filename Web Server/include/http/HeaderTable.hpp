@@ -0,0 +1,101 @@
+#ifndef CS252_HEADERTABLE_H
+#define CS252_HEADERTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+
+/**
+ * The headers of a request. Header names are compared without regard to case (RFC 7230),
+ * and the ones the server cares about have an Id, found with a perfect hash that is
+ * checked at compile time, so asking for them is an index into a fixed array.
+ * Everything is kept in one small vector in the order it arrived; the rest are found by
+ * walking it. A header that is set twice keeps its last value.
+ *
+ * The table does not copy anything: names and values are views into memory that whoever
+ * fills it keeps alive, which for a Request is its copy of the head.
+**/
+class HeaderTable
+{
+public:
+    enum Id
+    {
+        HOST,
+        CONNECTION,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        TRANSFER_ENCODING,
+        ACCEPT,
+        ACCEPT_ENCODING,
+        IF_NONE_MATCH,
+        IF_MODIFIED_SINCE,
+        IF_MATCH,
+        IF_UNMODIFIED_SINCE,
+        RANGE,
+        USER_AGENT,
+        EXPECT,
+        COOKIE,
+        AUTHORIZATION,
+        OTHER
+    };
+
+    static size_t const known = OTHER;
+
+    /**
+     * The Id of a header name, or OTHER if it is not one of the known ones.
+    **/
+    static Id lookup(std::string_view name) noexcept;
+
+    /**
+     * How a known header is usually spelled, such as "Content-Length".
+    **/
+    static std::string_view name(Id id) noexcept;
+
+    explicit HeaderTable(std::pmr::memory_resource* arena);
+
+    /**
+     * Adds a header or replaces its value. The second form is for callers that have
+     * looked up the Id already. Both views have to outlive the table.
+    **/
+    void set(std::string_view name, std::string_view value);
+    void set(Id id, std::string_view name, std::string_view value);
+
+    /**
+     * The value of a header, or nullptr if there is none.
+    **/
+    std::string_view const* find(Id id) const noexcept;
+    std::string_view const* find(std::string_view name) const noexcept;
+
+    size_t size() const noexcept;
+
+    /**
+     * Calls visit(name, value) for every header in the order they arrived.
+     * Known headers are named by name(), the others the way the client spelled them.
+    **/
+    template <typename Visit>
+    void for_each(Visit&& visit) const
+    {
+        for (Entry const& entry : m_entries)
+        {
+            visit(entry.id == OTHER ? entry.name : name(entry.id), entry.value);
+        }
+    }
+private:
+    struct Entry
+    {
+        Id id;
+        std::string_view name;
+        std::string_view value;
+    };
+
+    std::pmr::vector<Entry> m_entries;
+    // where each known header is in m_entries, or -1
+    int16_t m_slots[known];
+
+    // the position of a header that is not known in m_entries, or -1
+    int find_other(std::string_view name) const noexcept;
+};
+
+#endif
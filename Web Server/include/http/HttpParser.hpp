@@ -0,0 +1,128 @@
+#ifndef CS252_HTTPPARSER_H
+#define CS252_HTTPPARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "http/HttpStatus.hpp"
+#include "http/HeaderTable.hpp"
+
+/**
+ * An incremental parser for the head of an HTTP request: the request line and the headers.
+ * It works in place on the bytes a connection has received. parse() is handed everything
+ * buffered so far, picks up where the previous call stopped and never copies anything.
+ *
+ * What it finds is kept as offsets from the start of the request, so the buffer may move
+ * between calls as long as the request still starts at the front of what is passed in.
+ * The string_views handed out point into the buffer of the last parse() call.
+ *
+ * Methods and header names have to be tokens, and neither the target nor header values may
+ * hold control characters. Those checks run as CharScan spans, which find the delimiters too.
+ *
+ * Problems are reported by the result of parse() and error(), never by throwing,
+ * so the event loops can keep calling it as more bytes arrive.
+**/
+class HttpParser
+{
+public:
+    enum Result { PARSE_INCOMPLETE, PARSE_DONE, PARSE_ERROR };
+
+    /**
+     * max_head bounds the request line and headers together, blank line included.
+     * Longer heads are an error.
+    **/
+    explicit HttpParser(size_t max_head = 8192);
+
+    /**
+     * Continues parsing the request at the start of data. size may only grow between
+     * calls for the same request. Once the result is PARSE_DONE or PARSE_ERROR it stays
+     * that way until reset().
+    **/
+    Result parse(char const* data, size_t size) noexcept;
+
+    /**
+     * Gets ready for the next request. Headers keep their storage, so parsing
+     * on a connection stops allocating once it has seen its largest head.
+    **/
+    void reset() noexcept;
+
+    /**
+     * The parts of the request line. path and query are split at the first '?',
+     * query is empty if there is none.
+    **/
+    std::string_view method() const noexcept;
+    std::string_view path() const noexcept;
+    std::string_view query() const noexcept;
+    std::string_view version() const noexcept;
+
+    /**
+     * Headers in the order they were received, values without surrounding whitespace.
+     * Each is looked up in HeaderTable as it is parsed, and find_header() gets the value of
+     * the last header with a known id straight from its slot.
+    **/
+    size_t header_count() const noexcept;
+    HeaderTable::Id header_id(size_t i) const noexcept;
+    std::string_view header_name(size_t i) const noexcept;
+    std::string_view header_value(size_t i) const noexcept;
+    bool find_header(HeaderTable::Id id, std::string_view& value) const noexcept;
+
+    /**
+     * How many bytes the head takes up, blank line included. Only set once parse() is done.
+    **/
+    size_t head_length() const noexcept;
+
+    /**
+     * After PARSE_ERROR: the status to answer with and what went wrong, for the logs.
+    **/
+    HttpStatus const& error() const noexcept;
+    char const* error_text() const noexcept;
+private:
+    /**
+     * A part of the request, counted from its first byte.
+    **/
+    struct Span
+    {
+        uint32_t begin;
+        uint32_t length;
+    };
+
+    struct Header
+    {
+        Span name;
+        Span value;
+        HeaderTable::Id id;
+    };
+
+    enum State { STATE_REQUEST_LINE, STATE_HEADERS, STATE_DONE, STATE_ERROR };
+
+    static size_t const m_max_headers = 100;
+
+    size_t m_max_head;
+    State m_state;
+    char const* m_data;
+
+    // m_line is where the next unparsed line starts, m_scanned how far it is known to have no '\n'
+    size_t m_line;
+    size_t m_scanned;
+
+    Span m_method;
+    Span m_path;
+    Span m_query;
+    Span m_version;
+    std::vector<Header> m_headers;
+    // where the known headers are in m_headers, or -1
+    int16_t m_known[HeaderTable::known];
+    size_t m_head_length;
+
+    HttpStatus const* m_error;
+    char const* m_error_text;
+
+    Result fail(HttpStatus const& status, char const* text) noexcept;
+    Result parse_request_line(size_t begin, size_t end) noexcept;
+    Result parse_header_line(size_t begin, size_t end) noexcept;
+    std::string_view view(Span span) const noexcept;
+};
+
+#endif
@@ -12,10 +12,12 @@ private:
     enum HttpStatusCode
     {
         OK = 200,
+        NOT_MODIFIED = 304,
         BAD_REQUEST = 400,
         FORBIDDEN = 403,
         NOT_FOUND = 404,
         METHOD_NOT_ALLOWED = 405,
+        PRECONDITION_FAILED = 412,
         UNSUPPORTED_MEDIA_TYPE = 415,
         INTERNAL_SERVER_ERROR = 500,
         HTTP_VERSION_NOT_SUPPORTED = 505
@@ -27,14 +29,21 @@ private:
     HttpStatus(enum HttpStatusCode code, char const* text);
 public:
     static HttpStatus const Ok;
+    static HttpStatus const NotModified;
     static HttpStatus const BadRequest;
     static HttpStatus const Forbidden;
     static HttpStatus const NotFound;
     static HttpStatus const MethodNotAllowed;
+    static HttpStatus const PreconditionFailed;
     static HttpStatus const UnsupportedMediaType;
     static HttpStatus const InternalServerError;
     static HttpStatus const HttpVersionNotSupported;
 
+    /**
+     * The status with the given code, or nullptr if it is not one of the above.
+    **/
+    static HttpStatus const* find(int code) noexcept;
+
     std::string to_string() const noexcept;
 };
 
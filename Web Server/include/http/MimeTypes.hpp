@@ -0,0 +1,45 @@
+#ifndef CS252_MIMETYPES_H
+#define CS252_MIMETYPES_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * Works out the Content-Type of a file without leaving the process. The extension is looked
+ * up first: in the types loaded from a mime.types file, then in a table compiled in (sorted,
+ * so a lookup is a binary search). Files without a known extension have their first bytes
+ * compared against the signatures of common formats, and are text/plain if they look like
+ * text and application/octet-stream otherwise.
+ *
+ * Answers are remembered per path, so a file is only looked at the first time it is served.
+ * Everything here may be used from any thread once load() has returned.
+**/
+class MimeTypes
+{
+public:
+    /**
+     * Reads a mime.types file ("type ext ext ..." per line, '#' starts a comment), whose types
+     * win over the compiled in ones. Meant to be called once at startup, before any threads.
+     * Returns false if the file could not be read, in which case only the table is used.
+    **/
+    static bool load(std::string const& path);
+
+    /**
+     * The type for a file that has been resolved to path. fd, if not -1, is the file opened
+     * for reading, which saves opening it again if it has to be sniffed.
+    **/
+    static std::string_view resolve(std::string const& path, int fd = -1);
+
+    /**
+     * The type for a file extension without its dot, ignoring case, or an empty view.
+    **/
+    static std::string_view by_extension(std::string_view extension) noexcept;
+
+    /**
+     * The type the first bytes of a file look like.
+    **/
+    static std::string_view sniff(char const* data, size_t size) noexcept;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef CS252_MULTIPARTPARSER_H
+#define CS252_MULTIPARTPARSER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "http/HttpStatus.hpp"
+
+/**
+ * Splits a multipart/form-data body (RFC 7578) into its parts as the bytes come in.
+ * Like BodyDecoder it works on whatever has arrived, hands out part contents as views into
+ * it and never holds on to more than the few bytes that might be the start of a boundary,
+ * so a part can be any size. Only the headers of the current part are copied.
+ *
+ * Problems are reported by the result of parse() and error(), never by throwing.
+**/
+class MultipartParser
+{
+public:
+    enum Result
+    {
+        MULTIPART_INCOMPLETE,   // more bytes are needed to go on
+        MULTIPART_PART,         // the headers of the next part are in, see name() and friends
+        MULTIPART_DATA,         // piece is more of the current part
+        MULTIPART_END,          // the current part is over
+        MULTIPART_DONE,         // the closing boundary has been seen
+        MULTIPART_ERROR
+    };
+
+    /**
+     * The boundary parameter of a multipart Content-Type value, without quotes.
+     * Returns false if there is none or it is not a valid boundary.
+    **/
+    static bool find_boundary(std::string_view content_type, std::string_view& boundary) noexcept;
+
+    explicit MultipartParser(std::string_view boundary);
+
+    /**
+     * Parses from the start of data, which holds the bytes that follow what earlier calls
+     * used up. used is set to how many bytes this call used up, and for MULTIPART_DATA piece
+     * to the part contents among them. Bytes that might be the start of a boundary are only
+     * used once it is clear whether they are.
+    **/
+    Result parse(char const* data, size_t size, size_t& used, std::string_view& piece);
+
+    /**
+     * From the headers of the current part: the field name and the file name from its
+     * Content-Disposition (empty if it is not a file), and its Content-Type.
+    **/
+    std::string const& name() const noexcept;
+    std::string const& filename() const noexcept;
+    std::string const& content_type() const noexcept;
+
+    HttpStatus const& error() const noexcept;
+    char const* error_text() const noexcept;
+private:
+    enum State { STATE_PREAMBLE, STATE_DELIMITER, STATE_HEADERS, STATE_DATA, STATE_EPILOGUE, STATE_ERROR };
+
+    // header lines, and the headers of a part together, may not be longer than this
+    static size_t const m_max_line = 1024;
+    static size_t const m_max_headers = 8192;
+
+    // CRLF "--" boundary, which ends every part, m_at_start while the body might open with it minus the CRLF
+    std::string m_delimiter;
+    State m_state;
+    bool m_at_start;
+    size_t m_header_bytes;
+
+    std::string m_name;
+    std::string m_filename;
+    std::string m_content_type;
+
+    char const* m_error_text;
+
+    Result fail(char const* text) noexcept;
+    Result parse_header(std::string_view line);
+};
+
+#endif
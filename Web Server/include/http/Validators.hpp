@@ -0,0 +1,66 @@
+#ifndef CS252_VALIDATORS_H
+#define CS252_VALIDATORS_H
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+
+#include "http/HeaderTable.hpp"
+
+/**
+ * The validators of a representation, ETag and Last-Modified, and the conditional request
+ * headers that are checked against them (RFC 7232). Validators are meant to be worked out
+ * once per file and kept with it, see FileCache and OpenFileCache; checking a request
+ * against them only parses the request's headers and never allocates.
+**/
+class Validators
+{
+public:
+    enum Result
+    {
+        VALIDATORS_SEND,                // the preconditions hold (or there are none), send the file
+        VALIDATORS_NOT_MODIFIED,        // answer with 304 Not Modified
+        VALIDATORS_PRECONDITION_FAILED  // answer with 412 Precondition Failed
+    };
+
+    /**
+     * An HTTP-date in the preferred format, such as "Sun, 06 Nov 1994 08:49:37 GMT".
+    **/
+    static std::string http_date(time_t time);
+
+    /**
+     * Reads an HTTP-date in any of the three formats a recipient has to accept.
+     * Returns false if text is none of them.
+    **/
+    static bool parse_http_date(std::string_view text, time_t& time) noexcept;
+
+    /**
+     * A strong ETag from the contents of a file, a 64-bit FNV-1a hash.
+    **/
+    static std::string strong_etag(char const* data, size_t size);
+
+    /**
+     * A weak ETag from the size and modification time of a file, for files whose
+     * contents are not at hand. Two versions written within the same nanosecond and
+     * with the same size would share it, which is why it is weak.
+    **/
+    static std::string weak_etag(struct stat const& st);
+
+    /**
+     * Whether the comma separated list of entity tags from an If-Match or If-None-Match
+     * header names etag (or is "*"). The weak comparison ignores W/ prefixes, the strong
+     * one only matches strong tags. A malformed list matches nothing.
+    **/
+    static bool matches(std::string_view list, std::string_view etag, bool weak) noexcept;
+
+    /**
+     * Checks the conditional headers of a request for a file with the given validators,
+     * in the order RFC 7232 section 6 gives. get_or_head is whether the request was a
+     * GET or HEAD, which are the only ones that can be answered with 304.
+    **/
+    static Result evaluate(HeaderTable const& headers, bool get_or_head, std::string_view etag, time_t mtime) noexcept;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef CS252_BODYSPOOL_H
+#define CS252_BODYSPOOL_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Where a request body waits until its handler reads it. The first memory_limit bytes are
+ * kept in memory and anything past that moves to an unnamed temporary file, so a large
+ * upload costs a connection no more than memory_limit bytes of memory however big it is.
+ * The memory is kept for the next body, the file is closed (and with it gone) by clear().
+**/
+class BodySpool
+{
+public:
+    explicit BodySpool(size_t memory_limit);
+    ~BodySpool();
+    BodySpool(BodySpool const&) = delete;
+    BodySpool& operator=(BodySpool const&) = delete;
+
+    /**
+     * Adds bytes at the end. Throws a RequestError (500) if the temporary file can not
+     * be created or written.
+    **/
+    void append(char const* data, size_t size);
+
+    /**
+     * Reads up to size bytes that have not been read yet, returning how many it read.
+    **/
+    size_t read(char* buf, size_t size);
+
+    size_t size() const noexcept;
+    size_t unread() const noexcept;
+    bool on_disk() const noexcept;
+
+    void clear() noexcept;
+private:
+    size_t m_memory_limit;
+    std::vector<char> m_memory;
+    int m_file;
+    size_t m_size;
+    size_t m_read;
+
+    /**
+     * Opens the temporary file in $TMPDIR (/tmp if unset) and moves m_memory into it.
+    **/
+    void spill();
+};
+
+#endif
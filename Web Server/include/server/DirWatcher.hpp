@@ -0,0 +1,71 @@
+#ifndef CS252_DIRWATCHER_H
+#define CS252_DIRWATCHER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * Follows a directory and everything below it with inotify, for the caches that keep
+ * what they found there. A thread of its own reads the events and tells every listener
+ * which path changed, or an empty path when anything below the directory might have
+ * (a directory moved, events were lost).
+ *
+ * Watching starts with the first call to start(), so that processes forked before that
+ * each get a watcher of their own.
+**/
+class DirWatcher
+{
+public:
+    using Listener = std::function<void(std::string const& path)>;
+
+    /**
+     * Watches dir, which is resolved with realpath() so that the paths handed to listeners
+     * match resolved paths.
+    **/
+    explicit DirWatcher(std::string const& dir);
+    ~DirWatcher();
+    DirWatcher(DirWatcher const&) = delete;
+    DirWatcher& operator=(DirWatcher const&) = delete;
+
+    /**
+     * Adds a listener. Listeners are called on the watcher thread and have to be added
+     * before start() is first called.
+    **/
+    void listen(Listener listener);
+
+    /**
+     * Starts watching if that has not happened yet. Returns whether the directory is
+     * being watched, which it is not if inotify is not available.
+    **/
+    bool start();
+
+    /**
+     * Bumped before listeners hear of a change, so that something read while the
+     * generation stayed the same was not changed in the meantime.
+    **/
+    uint64_t generation() const noexcept;
+private:
+    std::string m_dir;
+    std::vector<Listener> m_listeners;
+
+    std::once_flag m_started;
+    bool m_watching;
+    int m_inotify;
+    int m_stop;
+    std::thread m_thread;
+    // watch descriptor to the directory it watches, only used by the watcher thread once it runs
+    std::unordered_map<int, std::string> m_watches;
+    std::atomic<uint64_t> m_generation;
+
+    void watch(std::string const& dir);
+    void watch_events();
+    void changed(std::string const& path);
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef CS252_FILECACHE_H
+#define CS252_FILECACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <sys/stat.h>
+#include <string>
+#include <string_view>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include "server/DirWatcher.hpp"
+
+/**
+ * Keeps small static files in memory together with the headers that describe them, so a
+ * hit is answered with one write and no file system calls. The cache is split into shards
+ * by path, each with its own lock and its own share of the byte budget, and each shard
+ * evicts its least recently used files when a new one does not fit.
+ *
+ * Entries are dropped as soon as the DirWatcher reports a change to their file, so the cache
+ * never serves a file that has been changed on disk. Without inotify nothing is cached.
+**/
+class FileCache
+{
+public:
+    struct Entry
+    {
+        std::string data;
+        // the Content-Length, Content-Type, ETag and Last-Modified header lines, ready to go out
+        std::string headers;
+        // a strong ETag from data, see Validators
+        std::string etag;
+        std::string last_modified;
+        time_t mtime;
+    };
+
+    /**
+     * How often the cache was asked (hits and misses), and how many files it has dropped
+     * to make room (evictions) or because they changed (invalidations).
+    **/
+    struct Stats
+    {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long evictions;
+        unsigned long invalidations;
+        size_t files;
+        size_t bytes;
+    };
+
+    /**
+     * Caches files below the directory watcher follows, using at most max_bytes of memory
+     * for their contents. A max_bytes of 0 turns the cache off.
+    **/
+    FileCache(DirWatcher& watcher, size_t max_bytes);
+    FileCache(FileCache const&) = delete;
+    FileCache& operator=(FileCache const&) = delete;
+
+    /**
+     * The entry for the file at path (as resolved by realpath()), or nullptr on a miss.
+     * The entry stays valid for as long as the caller holds on to it, even if it is evicted.
+    **/
+    std::shared_ptr<Entry const> find(std::string const& path);
+
+    /**
+     * Reads the open file fd, which is path with the given stat, into the cache.
+     * Returns nullptr without caching it if the file is too large for the cache,
+     * could not be read or changed while it was read.
+    **/
+    std::shared_ptr<Entry const> load(std::string const& path, int fd, struct stat const& st,
+                                      std::string_view content_type);
+
+    Stats stats() const noexcept;
+private:
+    static size_t const m_shard_count = 16;
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        // most recently used at the front, index points into it
+        std::list<std::pair<std::string, std::shared_ptr<Entry const>>> lru;
+        std::unordered_map<std::string, decltype(lru)::iterator> index;
+        size_t bytes = 0;
+    };
+
+    DirWatcher& m_watcher;
+    size_t m_shard_bytes;
+    Shard m_shards[m_shard_count];
+
+    std::atomic<unsigned long> m_hits;
+    std::atomic<unsigned long> m_misses;
+    std::atomic<unsigned long> m_evictions;
+    std::atomic<unsigned long> m_invalidations;
+
+    Shard& shard(std::string const& path) noexcept;
+
+    // called by m_watcher, an empty path drops everything
+    void invalidate(std::string const& path);
+    void invalidate_all();
+};
+
+#endif
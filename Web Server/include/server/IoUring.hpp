@@ -0,0 +1,102 @@
+#ifndef CS252_IOURING_H
+#define CS252_IOURING_H
+
+#include <vector>
+#include <cstddef>
+#include <linux/io_uring.h>
+
+/**
+ * A thin wrapper around a raw io_uring instance: the mmap()ed submission and completion
+ * rings, a sparse table of registered files and one ring of provided receive buffers.
+ * It only knows how to hand out SQEs and CQEs; what gets submitted is up to the caller.
+ * Everything here must be used from a single thread.
+**/
+class IoUring
+{
+private:
+    int m_fd;
+    struct io_uring_params m_params;
+
+    void* m_sq_ring;
+    size_t m_sq_ring_size;
+    void* m_cq_ring;
+    size_t m_cq_ring_size;
+    struct io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned* m_sq_array;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe* m_cqes;
+
+    /**
+     * SQEs handed out by get_sqe() but not yet passed to the kernel.
+    **/
+    unsigned m_to_submit;
+
+    struct io_uring_buf_ring* m_buf_ring;
+    size_t m_buf_ring_size;
+    unsigned m_buf_entries;
+    unsigned m_buf_size;
+    std::vector<char> m_bufs;
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+public:
+    /**
+     * Group id of the provided receive buffers, for IOSQE_BUFFER_SELECT.
+    **/
+    static unsigned short const buf_group = 0;
+
+    /**
+     * Sets up a ring with room for entries submissions.
+     * Throws a ConfigError explaining why if the running kernel can not provide
+     * everything the io_uring server mode needs.
+    **/
+    IoUring(unsigned entries);
+    ~IoUring() noexcept;
+
+    IoUring(IoUring const&) = delete;
+    IoUring& operator=(IoUring const&) = delete;
+
+    /**
+     * Registers a table of count empty file slots. Slots are filled with
+     * IORING_OP_FILES_UPDATE and used with IOSQE_FIXED_FILE.
+    **/
+    void register_file_slots(unsigned count);
+
+    /**
+     * Registers entries receive buffers of size bytes each under buf_group.
+    **/
+    void provide_buffers(unsigned entries, unsigned size);
+
+    /**
+     * The provided buffer with id bid, and a way to give it back to the kernel once
+     * its contents have been copied out.
+    **/
+    char const* buffer(unsigned short bid) const noexcept;
+    void recycle_buffer(unsigned short bid) noexcept;
+
+    /**
+     * Returns a zeroed SQE to fill in. If the submission ring is full, whatever is
+     * queued gets submitted first.
+    **/
+    struct io_uring_sqe* get_sqe();
+
+    /**
+     * Submits everything queued and waits until at least one completion is available.
+    **/
+    void submit_and_wait();
+
+    /**
+     * The oldest unconsumed completion, or nullptr if there is none.
+     * Call cqe_seen() when done with it.
+    **/
+    struct io_uring_cqe* peek_cqe() noexcept;
+    void cqe_seen() noexcept;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef CS252_MAPPEDFILES_H
+#define CS252_MAPPEDFILES_H
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * Shared read-only mappings of the static files that are too large for the FileCache,
+ * so that every worker sends them from the same page cache pages without opening them
+ * again. The table keeps the most recently used mappings, and each response that is
+ * sending from a mapping holds a reference to it, so evicting one never pulls it out
+ * from under a write.
+ *
+ * A file can change while it is mapped. Every lookup checks it with fstat() and maps it
+ * again if it has, and mappings are only ever read by the kernel (see TcpConnection::putref()),
+ * so a file that is truncated in the middle of a response ends that response with EFAULT
+ * rather than the whole server with SIGBUS.
+**/
+class MappedFiles
+{
+public:
+    class Mapping
+    {
+    public:
+        char const* data;
+        size_t size;
+
+        Mapping(char const* data, size_t size, int fd, struct stat const& st) noexcept;
+        ~Mapping();
+        Mapping(Mapping const&) = delete;
+        Mapping& operator=(Mapping const&) = delete;
+
+        /**
+         * Whether the file is still the one that was mapped: same size and modification
+         * time, and not unlinked or replaced.
+        **/
+        bool current() const noexcept;
+    private:
+        int m_fd;
+        struct timespec m_mtime;
+    };
+
+    /**
+     * Keeps at most max_mappings files mapped, 0 maps none.
+    **/
+    explicit MappedFiles(size_t max_mappings);
+    MappedFiles(MappedFiles const&) = delete;
+    MappedFiles& operator=(MappedFiles const&) = delete;
+
+    /**
+     * The mapping of the file at path, or nullptr if it is not mapped or has changed.
+    **/
+    std::shared_ptr<Mapping const> find(std::string const& path);
+
+    /**
+     * Maps the open file fd, which is path with the given stat. Returns nullptr if the
+     * file can not be mapped (empty files can not). fd stays the caller's.
+    **/
+    std::shared_ptr<Mapping const> map(std::string const& path, int fd, struct stat const& st);
+private:
+    size_t m_max_mappings;
+
+    std::mutex m_mutex;
+    // most recently used at the front, m_index points into it
+    std::list<std::pair<std::string, std::shared_ptr<Mapping const>>> m_lru;
+    std::unordered_map<std::string, decltype(m_lru)::iterator> m_index;
+
+    void erase(std::string const& path, Mapping const* mapping);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef CS252_MPMCQUEUE_H
+#define CS252_MPMCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * A bounded multi-producer multi-consumer queue without locks (Dmitry Vyukov's design).
+ * Every cell carries a sequence number that tells producers and consumers whose turn it is,
+ * so each side only ever contends on its own position counter with a compare-and-swap.
+ * The capacity is rounded up to a power of two.
+ * try_push() and try_pop() never block; they return false if the queue is full or empty.
+**/
+template <typename T>
+class MpmcQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // the two counters live on their own cache lines so producers and consumers do not share one
+    static size_t const cache_line = 64;
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    alignas(cache_line) std::atomic<size_t> m_enqueue_pos;
+    alignas(cache_line) std::atomic<size_t> m_dequeue_pos;
+
+    static size_t round_up(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+public:
+    explicit MpmcQueue(size_t capacity) :
+        m_cells(new Cell[round_up(capacity)]),
+        m_mask(round_up(capacity) - 1),
+        m_enqueue_pos(0),
+        m_dequeue_pos(0)
+    {
+        for (size_t i = 0; i <= m_mask; i++)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(MpmcQueue const&) = delete;
+    MpmcQueue& operator=(MpmcQueue const&) = delete;
+
+    size_t capacity() const noexcept
+    {
+        return m_mask + 1;
+    }
+
+    bool try_push(T const& value) noexcept
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+            if (diff == 0)
+            {
+                // the cell is free for this position, claim it
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // the consumer of the previous lap has not taken this cell yet
+                return false;
+            }
+            else
+            {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value) noexcept
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+
+            if (diff == 0)
+            {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // nothing has been pushed into this cell yet
+                return false;
+            }
+            else
+            {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = cell->value;
+        // hand the cell to the producer one lap ahead
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif
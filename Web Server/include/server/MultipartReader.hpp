@@ -0,0 +1,76 @@
+#ifndef CS252_MULTIPARTREADER_H
+#define CS252_MULTIPARTREADER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "http/MultipartParser.hpp"
+
+class Request;
+
+/**
+ * Walks the parts of a multipart/form-data request body while it is read (see
+ * Request::read_body()), so a handler can deal with each part as it arrives.
+ * Everything goes through one fixed buffer, so reading or saving a part of any size
+ * takes the same memory.
+ *
+ * Throws a RequestError if the body is not valid multipart or ends before its closing
+ * boundary, and whatever read_body() throws.
+**/
+class MultipartReader
+{
+public:
+    MultipartReader(Request const& req, std::string_view boundary);
+    MultipartReader(MultipartReader const&) = delete;
+    MultipartReader& operator=(MultipartReader const&) = delete;
+
+    /**
+     * Moves on to the next part, skipping whatever is left of the current one.
+     * Returns false once there are no more parts.
+    **/
+    bool next_part();
+
+    /**
+     * The headers of the current part (see MultipartParser).
+    **/
+    std::string const& name() const noexcept;
+    std::string const& filename() const noexcept;
+    std::string const& content_type() const noexcept;
+
+    /**
+     * Reads up to size bytes of the current part into buf. Returns 0 once the part is over.
+    **/
+    size_t read(char* buf, size_t size);
+
+    /**
+     * Writes the rest of the current part to a new file in dir and returns its path.
+     * size is set to how many bytes were written. The file is the caller's to remove.
+    **/
+    std::string save(std::string const& dir, size_t& size);
+private:
+    static size_t const m_buffer_size = 16384;
+
+    Request const& m_req;
+    MultipartParser m_parser;
+    char m_buffer[m_buffer_size];
+    size_t m_start;
+    size_t m_end;
+    bool m_in_part;
+    bool m_done;
+    // part contents the parser handed out that have not been read yet, inside m_buffer
+    std::string_view m_piece;
+
+    /**
+     * Runs the parser until it has something to say other than MULTIPART_INCOMPLETE,
+     * reading more of the body whenever it needs to.
+    **/
+    MultipartParser::Result step();
+
+    /**
+     * Sets piece to the next part contents, returns false once the part is over.
+    **/
+    bool next_piece(std::string_view& piece);
+};
+
+#endif
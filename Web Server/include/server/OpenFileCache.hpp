@@ -0,0 +1,98 @@
+#ifndef CS252_OPENFILECACHE_H
+#define CS252_OPENFILECACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include "server/DirWatcher.hpp"
+
+/**
+ * Remembers what requested paths turned out to be: the resolved path, an open descriptor
+ * and its stat, or that there is nothing to serve there. A repeated request then costs no
+ * realpath(), open() or fstat() at all, and a flood of requests for paths that do not
+ * exist costs one lookup each.
+ *
+ * An entry is trusted for ttl and only as long as nothing below the directory has changed
+ * since it was made (see DirWatcher::generation()); any change retires every entry at once,
+ * which for a static directory is rare enough to be cheaper than working out which paths
+ * a change affects. The cache is split into shards with a lock and an LRU list each, and
+ * entries are shared, so a descriptor stays open while a response is still using it.
+**/
+class OpenFileCache
+{
+public:
+    /**
+     * A file ready to be served, or (fd == -1) a path with nothing to serve.
+     * It owns fd, which is only ever read at explicit offsets, so it can be shared.
+     * The validators are worked out from st once, when the file is opened.
+    **/
+    class File
+    {
+    public:
+        std::string resolved;
+        int fd;
+        struct stat st;
+        // a weak ETag and the Last-Modified date, empty if there is nothing to serve
+        std::string etag;
+        std::string last_modified;
+
+        File(std::string resolved, int fd, struct stat const& st);
+        ~File();
+        File(File const&) = delete;
+        File& operator=(File const&) = delete;
+
+        bool exists() const noexcept;
+    };
+
+    /**
+     * Remembers at most max_files paths for ttl_ms each. 0 files remembers none.
+    **/
+    OpenFileCache(DirWatcher& watcher, size_t max_files, long ttl_ms);
+    OpenFileCache(OpenFileCache const&) = delete;
+    OpenFileCache& operator=(OpenFileCache const&) = delete;
+
+    /**
+     * What requested was found to be, or nullptr if that is not known (any more).
+    **/
+    std::shared_ptr<File const> find(std::string_view requested);
+
+    /**
+     * Remembers file for requested. generation is m_watcher's from before the path was
+     * resolved; if something changed since, file is handed back without being remembered.
+    **/
+    std::shared_ptr<File const> insert(std::string_view requested, std::shared_ptr<File const> file, uint64_t generation);
+private:
+    static size_t const m_shard_count = 16;
+
+    struct Node
+    {
+        std::string requested;
+        std::shared_ptr<File const> file;
+        uint64_t generation;
+        long expires;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        // most recently used at the front, index points into it and uses its keys
+        std::list<Node> lru;
+        std::unordered_map<std::string_view, std::list<Node>::iterator> index;
+    };
+
+    DirWatcher& m_watcher;
+    size_t m_shard_files;
+    long m_ttl_ms;
+    Shard m_shards[m_shard_count];
+
+    Shard& shard(std::string_view requested) noexcept;
+};
+
+#endif
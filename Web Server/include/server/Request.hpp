@@ -2,18 +2,82 @@
 #define CS252_REQUEST_H
 
 #include <unordered_map>
+#include <vector>
 #include <string>
+#include <string_view>
+#include <memory_resource>
 
 #include "Config.hpp"
+#include "http/HeaderTable.hpp"
 #include "server/TcpConnection.hpp"
 
 class Request
 {
 public:
+    /**
+     * Everything a request parses is allocated from its connection's arena
+     * (see TcpConnection::arena()), which is reset in one go once the request is answered.
+    **/
+    using String = std::pmr::string;
+    using Table = std::pmr::unordered_map<String, String>;
+
+    /**
+     * A file part of a multipart/form-data body, saved under Config::upload_dir.
+     * The file is removed when the request is destroyed, unless take_uploads() handed it over.
+    **/
+    struct Upload
+    {
+        std::string field;
+        std::string filename;
+        std::string content_type;
+        std::string path;
+        size_t size;
+    };
+
     /**
      * The Request constructor kicks off the parsing of the incoming request.
     **/
     Request(Config const& config, TcpConnection& conn);
+    ~Request();
+
+    /**
+     * Looks at the bytes conn has received so far and decides whether a whole request is
+     * among them, so that non-blocking servers only construct a Request once parsing can
+     * not stall. Returns 0 while more bytes are needed, otherwise the number of bytes the
+     * request will consume. Requests the parser is going to reject anyway (a malformed or
+     * oversized head, an oversized body) count as complete as soon as that is known.
+     * Parsing resumes where the previous call left off, so calling this after every read
+     * costs no more than parsing the head once.
+     * Once the head is in, the body is moved from the receive buffer to the connection's
+     * spool as it arrives, so the request only consumes its head and the body waits on
+     * disk if it is large.
+    **/
+    static size_t buffered_length(Config const& config, TcpConnection& conn) noexcept;
+
+    /**
+     * Whether conn holds the whole head of a request (everything up to the blank line).
+    **/
+    static bool head_buffered(TcpConnection& conn) noexcept;
+
+    /**
+     * Pulls the next bytes of the body into buf, without its framing: whatever was spooled
+     * first, then straight from the connection. Returns 0 once the body is over.
+     * Handlers that do not want the whole body in memory read it this way.
+     * Throws a RequestError if the framing is broken or the body is too large,
+     * and a ConnectionError if the client goes away.
+    **/
+    size_t read_body(char* buf, size_t size) const;
+
+    /**
+     * Reads and drops whatever is left of the body, so the connection can carry the next
+     * request. Returns false if that failed and the connection has to be closed.
+    **/
+    bool discard_body() const noexcept;
+
+    /**
+     * Whether the Content-Type is type, ignoring case and any parameters after a ';'.
+    **/
+    bool content_type_is(std::string_view type) const noexcept;
 
     /**
      * Request::print() is a convenience method that prints the method, path, and version
@@ -27,52 +91,70 @@ public:
      * Convenience method to check if a header exists and store it in value if it does
     **/
     bool try_header(std::string const& key, std::string& value) const noexcept;
+    bool try_header(HeaderTable::Id id, std::string& value) const noexcept;
 
     /**
-     * Accessor methods that all simply return the corresponding request member variable.
-     * Return const references to avoid copying if possible
+     * The value of a header, or nullptr if the request does not have one.
+     * Headers with an id are a slot lookup, other names are compared ignoring case.
     **/
-    std::string const& get_path() const noexcept;
-    std::string const& get_method() const noexcept;
-    std::string const& get_version() const noexcept;
-    std::unordered_map<std::string, std::string> const& get_headers() const noexcept;
-    std::unordered_map<std::string, std::string> const& get_query() const noexcept;
-    std::unordered_map<std::string, std::string> const& get_body() const noexcept;
-private:
-    Config const& m_config;
-    TcpConnection& m_conn;
-    std::unordered_map<std::string, std::string> m_headers;
-    std::unordered_map<std::string, std::string> m_query;
-    std::unordered_map<std::string, std::string> m_body_data;
-    std::string m_path;
-    std::string m_method;
-    std::string m_version;
-    int const m_max_buf = 512;
+    std::string_view const* find_header(HeaderTable::Id id) const noexcept;
+    std::string_view const* find_header(std::string_view key) const noexcept;
 
     /**
-     * We think its useful to break up the parsing of the method, path, version, and headers
-     * into separate methods (also query and body data for the extra credit)
-     * When you encounter an unexpected format, you should send a response with the
-     * "400 Bad Request" status code except for the specific cases noted below.
+     * Whether the client wants the connection kept open after this request.
+     * That is the default for HTTP/1.1 unless a Connection header says "close",
+     * while HTTP/1.0 clients have to ask for it with "Connection: keep-alive".
     **/
+    bool keep_alive() const noexcept;
 
     /**
-     * :: TODO ::
-     * parse_method() looks for "GET" at the start of the request_line (as well as "POST" 
-     * for extra credit)
-     * If request_line does not start with either, you will need to send a response with
-     * the "405 Method Not Allowed" status text.
+     * Accessor methods that all simply return the corresponding request member variable.
+     * Return const references to avoid copying if possible
+     * The query and the body are only decoded the first time they are asked for,
+     * so requests whose handler never looks at them do not pay for it.
+     * get_body() reads the whole body (see read_body()) and only has fields if it is
+     * application/x-www-form-urlencoded or multipart/form-data. The file parts of a multipart
+     * body are written to disk as they arrive instead, get_uploads() says where.
+     * Handlers that want each part as it arrives use a MultipartReader instead of both.
     **/
-    void parse_method(std::string& request_line);
+    String const& get_path() const noexcept;
+    String const& get_method() const noexcept;
+    String const& get_version() const noexcept;
+    HeaderTable const& get_headers() const noexcept;
+    Table const& get_query() const;
+    Table const& get_body() const;
+    std::vector<Upload> const& get_uploads() const;
 
     /**
-     * :: TODO ::
-     * parse_route() looks for a string starting with a "/" at the beginning of the request_line.
-     * If that does not exist, you will need to send a response with the "400 Bad Request" status.
-     * If you do the extra credit, this is where you can call parse_querystring() with the
-     * start of the parsed path after the first "?" to fill in the m_query map
+     * Hands the uploaded files over to the caller, who then has to remove them, so that they
+     * can outlive the request (see ExecScriptController::Script). Reads the body like get_uploads().
+    **/
+    std::vector<Upload> take_uploads() const;
+private:
+    Config const& m_config;
+    TcpConnection& m_conn;
+    std::pmr::memory_resource* m_arena;
+    // the head as received, which the headers and the raw query point into
+    String m_head;
+    HeaderTable m_headers;
+    std::string_view m_raw_query;
+    mutable String m_raw_body;
+    mutable Table m_query;
+    mutable Table m_body_data;
+    mutable std::vector<Upload> m_uploads;
+    mutable bool m_query_parsed;
+    mutable bool m_body_parsed;
+    String m_path;
+    String m_method;
+    String m_version;
+
+    /**
+     * parse_head() runs the connection's HttpParser (see TcpConnection::parser()) over the
+     * receive buffer, reading more whenever it needs to, and copies the head into the arena
+     * in one piece before it is consumed. Headers and the query string are only views into
+     * that copy. A head the parser rejects is thrown as a RequestError with the status it picked.
     **/
-    void parse_route(std::string& request_line);
+    void parse_head();
 
     /**
      * :: TODO ::
@@ -81,54 +163,29 @@ private:
      * This method takes a map argument because its used for parsing both route query strings
      * as well as body data.
      * The correct map should be passed in by reference by the caller.
+     * Keys and values come out percent-decoded, with '+' standing for a space.
     **/
-    void parse_querystring(std::string query, std::unordered_map<std::string, std::string>& parsed);
+    void parse_querystring(std::string_view query, Table& parsed) const;
 
     /**
-     * :: TODO ::
-     * parse_version() takes the rest of request_line and looks for an exact match for
-     * either "HTTP/1.0" or "HTTP/1.1".
-     * If it does not find this, you should send a response with the "505 HTTP Version Not Supported"
-     * status code
+     * Works out from the parsed head how the body is framed and sets up the connection's
+     * BodyDecoder for it. A body that is framed wrongly or larger than config.max_body
+     * leaves the decoder failed with the status to answer with.
+     * Only POST requests have bodies.
     **/
-    void parse_version(std::string& request_line);
+    static void start_body(Config const& config, HttpParser const& parser, BodyDecoder& body) noexcept;
 
     /**
-     * :: TODO ::
-     * parse_headers() will keep reading lines until it finds a line of length 0 (if parse_raw_line()
-     * cuts off the trailing \r\n) or of length 2 otherwise.
-     * For each line it reads, it should parse the header in that line and add it to m_headers
-    **/
-    void parse_headers();
-
-    /**
-     * :: TODO ::
-     * parse_body() only needs to be implemented for extra credit.
-     * If the request is a POST request *and* if the Content-Type of the request is
-     * "application/x-www-form-urlencoded", read in the entire rest of the request.
-     * You can assume that requests will contain a valid Content-Length header,
-     * which will tell you how large to make your buffer.
-     * If the method is GET, there will never be a body, but this method should just no-op
-     * If Content-Length is greater than 4096, you should send a response with the
-     * "403 Forbidden" status code
-     * If the Content-Type is not "application/x-www-form-urlencoded", you should send a
-     * response with the "415 Unsupported Media Type" status code
+     * parse_body() does not read the body, handlers do that when they want it. It throws the
+     * RequestError for a body that was found to be bad before the handler got to run.
     **/
     void parse_body();
 
     /**
-     * :: TODO ::
-     * Even if you do not use the parse_{method|path|version|headers} methods, we highly
-     * recommend implementing this one.
-     * This method should be the only place where m_conn.getc() should be called.
-     * It can build up a buffer of up to m_max_buf characters until it finds a \r
-     * followed by an \n.
-     * When it finds this or hits m_max_buf-1 characters read, it returns a std::string
-     * version of the buffer for use by other internal methods.
-     * You may choose to either return a string that contains the trailing \r\n or not.
-     * If you choose to do so, make sure you account for it in the rest of your code!
-    **/
-    std::string parse_raw_line();
+     * Reads a multipart/form-data body part by part: fields go into m_body_data,
+     * files are saved to config.upload_dir and listed in m_uploads.
+    **/
+    void parse_multipart() const;
 };
 
 #endif
@@ -2,8 +2,11 @@
 #define CS252_RESPONSE_H
 
 #include <string>
+#include <string_view>
 #include <cstring>
 #include <map>
+#include <memory>
+#include <memory_resource>
 
 #include "server/TcpConnection.hpp"
 #include "http/HttpStatus.hpp"
@@ -15,27 +18,65 @@ private:
     Config const& m_config;
     TcpConnection& m_conn;
     bool m_headers_sent;
-    std::string m_status_text;
+
+    /**
+     * Like the request, the response allocates from the connection's arena.
+    **/
+    std::pmr::memory_resource* m_arena;
+    std::pmr::string m_status_text;
+    std::pmr::string m_version;
+    bool m_keep_alive;
+    // answering a HEAD request, so bodies are left out
+    bool m_head_only;
 
     /**
      * We want to use a std::map here instead of a std::unordered_map,
      * which is what most of the rest of the skeleton code suggests using
      * This is so that we can maintain deterministic ordering for testing
     **/
-    std::map<std::string, std::string> m_headers;
+    std::pmr::map<std::pmr::string, std::pmr::string> m_headers;
+
+    /**
+     * Appends every header in m_headers to out as "Key: Value\r\n" lines.
+    **/
+    void serialize_headers(std::pmr::string& out) const;
+
+    /**
+     * Builds everything that goes in front of the body: the status line and,
+     * unless raw is set, the headers and the blank line that ends them.
+     * prepared is header lines to add after the ones in m_headers.
+    **/
+    std::pmr::string build_head(bool raw, std::string_view prepared = std::string_view()) const;
 
-    void send_headers();
+    /**
+     * Settles the Connection header right before the head goes out. A response can only
+     * leave the connection open if the client can tell where its body ends, so raw
+     * responses and responses without a Content-Length always close it.
+    **/
+    void settle_connection(bool raw);
 public:
     /**
      * The Response constructor doesn't do much of anything on its own.
+     * version is the HTTP version of the status line. If keep_alive is set, the connection
+     * stays open for another request once this response is sent, otherwise it is shut down.
+     * Error responses to requests that could not be parsed use the defaults.
+     * With head_only set the response answers a HEAD request: everything goes out as it
+     * would for a GET, headers included, except for the body, which the send methods drop.
+     * Raw bodies carry their own headers, so only what follows their first blank line is dropped.
+    **/
+    Response(Config const& config, TcpConnection& conn, std::string_view version = "HTTP/1.0", bool keep_alive = false,
+             bool head_only = false);
+
+    /**
+     * Whether the connection stays open after this response.
     **/
-    Response(Config const& config, TcpConnection& conn);
+    bool keeps_alive() const noexcept;
 
     /**
      * :: TODO ::
      * Called by controllers to set an arbitrary header on the response.
     **/
-    void set_header(std::string const& key, std::string const& value);
+    void set_header(std::string_view key, std::string_view value);
 
     /**
      * Called by controllers to set the status of a response.
@@ -44,14 +85,43 @@ public:
     void set_status(HttpStatus const& status);
 
     /**
-     * :: TODO ::
-     * Sends the body of the response.
+     * Sends the status line, headers and body of the response with a single vectored write.
      * The body is a void const* because it could be text or binary data, this method
      * does not need to know or care.
      * Callers would only call with raw = true when they do not want to flush the
-     * response's headers (such as for extra credit, where the scripts write their own headers)
+     * response's headers (such as for extra credit, where the scripts write their own headers).
+     * In that case buf goes out right after the status line and must carry its own blank line.
     **/
     void send(void const* buf, size_t size, bool raw = false);
+
+    /**
+     * Like send(), for bodies whose headers were put together ahead of time (see FileCache).
+     * prepared holds whole header lines, Content-Length among them, and goes out after the
+     * headers set on the response, so the status line, all headers and the body still leave
+     * in a single vectored write.
+    **/
+    void send_prepared(std::string_view prepared, void const* buf, size_t size);
+
+    /**
+     * Sends the status line and headers of a response that never has a body, such as
+     * 304 Not Modified. Since the client knows there is nothing more to read, the connection
+     * stays as it is even without a Content-Length.
+    **/
+    void send_empty();
+
+    /**
+     * Sends the status line and headers followed by size bytes of the open file fd.
+     * The body is handed to the kernel with sendfile(), so the file never has to be
+     * read into memory. The caller still owns fd and must close it.
+    **/
+    void send_file(int fd, size_t size);
+
+    /**
+     * Sends the status line and headers followed by size bytes at buf, which keep owns
+     * (see TcpConnection::putref()). keep is held until the body is written, however long
+     * that takes, so buf can be a file mapping that another thread might drop.
+    **/
+    void send_shared(std::shared_ptr<void const> keep, void const* buf, size_t size);
 };
 
 #endif
@@ -1,26 +1,176 @@
 #ifndef CS252_SERVER_H
 #define CS252_SERVER_H
 
+#include <functional>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
+#include <pthread.h>
 
 #include "Config.hpp"
 #include "server/TcpConnection.hpp"
 #include "controller/Controller.hpp"
+#include "controller/TextController.hpp"
+#include "controller/ExecScriptController.hpp"
+#include "controller/SendFileController.hpp"
 #include "http/HttpStatus.hpp"
+#include "server/IoUring.hpp"
+#include "server/TimerWheel.hpp"
 
 class Server {
 private:
     Config const& m_config;
     int m_master;
 
+    /**
+     * Every listening socket, starting with m_master.
+     * With --reuseport there is one per pool thread or pre-forked worker, all bound to the same port.
+    **/
+    std::vector<int> m_listeners;
+
+    /**
+     * The controllers requests are routed to. They only hold on to the config,
+     * so they are built once and shared by every thread.
+    **/
+    TextController const m_hello_world;
+    ExecScriptController const m_scripts;
+    SendFileController const m_files;
+
+    /**
+     * Creates a socket that listens on port, with SO_REUSEPORT set if the config asks for it.
+    **/
+    int open_listener(unsigned short port) const;
+
+    /**
+     * Accepts and handles connections on master one at a time, until they have carried
+     * request_limit requests between them, or forever if request_limit is 0.
+    **/
+    void accept_loop(int master, int request_limit = 0) const;
+
+    /**
+     * Forks a pre-forked worker that runs work and exits once work returns.
+     * Keeps trying once a second if the system can not take another process right now.
+    **/
+    pid_t spawn_worker(std::function<void()> const& work) const;
+
+    /**
+     * Pre-forked workers with --handoff. run_handoff() is the only one to accept connections
+     * and passes each of them over a Unix socket (SCM_RIGHTS) to the worker with the fewest
+     * connections in flight. serve_handoff() is the worker's side: it answers whatever comes
+     * in on channel and reports back on it after every connection, see Server.cpp.
+    **/
+    struct HandoffWorker;
+    void run_handoff() const;
+    void spawn_handoff_worker(HandoffWorker& worker, std::vector<HandoffWorker> const& workers,
+                              std::vector<HandoffWorker> const& retiring) const;
+    void serve_handoff(int channel) const;
+
+    /**
+     * The CPUs this process may run on, and a way to pin a pool thread (and the
+     * listener it accepts on, through SO_INCOMING_CPU) to one of them.
+    **/
+    static std::vector<int> available_cpus();
+    static void pin_worker(pthread_t thread, int listener, int cpu);
+
+    /**
+     * The thread pool with --reuseport: every thread accepts on its own listener.
+    **/
+    void run_sharded_pool() const;
+
+    /**
+     * Thread pool bookkeeping, see Server.cpp. print_pool_stats() never returns; every
+     * --stats seconds it prints how long connections waited in the queue and how long
+     * each worker spent serving them, followed by the counters of the static file cache.
+    **/
+    struct PoolJob;
+    struct PoolStats;
+    void print_pool_stats(PoolStats const* stats) const;
+
     /**
      * :: TODO ::
      * Each of the run* functions below use common logic for handling connected requests,
      * so you should split out that logic into its own function here.
+     * It answers requests on conn for as long as the client keeps the connection alive.
     **/
     void handle(TcpConnection* conn) const;
+
+    /**
+     * Reads, routes and answers a single request on conn.
+     * Returns true if the connection stays open for another request, in which case
+     * handle() waits up to the keep-alive timeout for it. The event loops call this
+     * directly whenever a complete request is buffered. They can not wait for a script,
+     * so they pass deferred: a script is then only prepared and handed back in a new
+     * ScriptJob instead of being run, and the request is answered later on.
+    **/
+    struct ScriptJob;
+    bool handle_request(TcpConnection* conn, ScriptJob** deferred = nullptr) const;
+
+    /**
+     * Scripts for the event loops, see Server.cpp. Each one runs on a thread of its own,
+     * which leaves its job in the loop's ScriptQueue once the script is done. The loop then
+     * answers the request with answer_script(); until then the connection serves nothing else.
+    **/
+    struct ScriptQueue;
+    void start_script(ScriptQueue& scripts, ScriptJob* job) const;
+    void answer_script(TcpConnection* conn, ScriptJob const& job) const;
+
+    /**
+     * Event loop helpers.
+     * accept_ready() accepts every pending connection on m_master and registers it with epfd.
+     * on_ready() advances a connection after epoll reported events for it: it flushes queued
+     * output, reads what has arrived and answers every complete request in the buffer.
+     * It returns false once the connection is finished and should be deleted.
+     * scripts_ready() answers the requests whose scripts are done.
+    **/
+    struct EpollConnection;
+    void accept_ready(int epfd, TimerWheel& wheel) const;
+    bool on_ready(EpollConnection* ec, unsigned int events, ScriptQueue& scripts) const;
+    void scripts_ready(ScriptQueue& scripts, TimerWheel& wheel) const;
+
+    /**
+     * Deadlines for the event loops, where a slow client can not block anyone but still
+     * costs a connection. Every connection keeps a timer on the wheel for the phase it is in
+     * (reading a head, reading a body, writing a response or waiting for the next request),
+     * which starts over when the connection moves to another phase, and for writes whenever
+     * the client took more of the response. Connections whose timer runs out are closed.
+     * update_deadline() is called after every event on a connection. A connection that waits
+     * for a script has no deadline of its own, the script has one (see ExecScriptController::execute()).
+    **/
+    enum Phase { PHASE_NONE, PHASE_HEADER, PHASE_BODY, PHASE_WRITE, PHASE_IDLE };
+    struct Deadline;
+    static Phase phase_of(TcpConnection* conn) noexcept;
+    void update_deadline(TimerWheel& wheel, Deadline& deadline, TcpConnection* conn, bool scripting = false) const;
+
+    /**
+     * Answers every complete request already in conn's receive buffer, queueing the responses
+     * so they can be written out together, up to a batch size. Does nothing while an
+     * earlier batch is still waiting to be written. A request for a script ends the batch:
+     * the script is started for owner, the event loop's connection, and true is returned.
+    **/
+    bool serve_buffered(TcpConnection* conn, ScriptQueue& scripts, void* owner) const;
+
+    /**
+     * io_uring helpers, see Server.cpp for the state kept per connection.
+     * uring_write() submits the next step of writing out whatever the connection has queued
+     * and serves the next batch of buffered requests once that is done. uring_expire() fails
+     * a connection whose deadline passed, and uring_close() tears a connection down once
+     * nothing in the ring (or a script) refers to it anymore. uring_settle() does whichever
+     * of closing it or updating its deadline is due after something happened to it.
+     * uring_arm_scripts() polls the ScriptQueue's eventfd, and uring_scripts_done() answers
+     * the requests whose scripts are done once it is readable.
+    **/
+    struct UringConnection;
+    void uring_complete(IoUring& ring, struct io_uring_cqe const* cqe, std::vector<int>& free_slots, TimerWheel& wheel,
+                        ScriptQueue& scripts) const;
+    void uring_expire(IoUring& ring, UringConnection* uc, std::vector<int>& free_slots, ScriptQueue& scripts) const;
+    void uring_arm_accept(IoUring& ring) const;
+    void uring_arm_recv(IoUring& ring, UringConnection* uc) const;
+    void uring_arm_scripts(IoUring& ring, ScriptQueue& scripts) const;
+    void uring_scripts_done(IoUring& ring, std::vector<int>& free_slots, TimerWheel& wheel, ScriptQueue& scripts) const;
+    void uring_write(IoUring& ring, UringConnection* uc, ScriptQueue& scripts) const;
+    void uring_settle(IoUring& ring, UringConnection* uc, std::vector<int>& free_slots, TimerWheel& wheel) const;
+    void uring_close(IoUring& ring, UringConnection* uc, std::vector<int>& free_slots) const;
 public:
     /**
      * :: TODO ::
@@ -43,6 +193,27 @@ public:
     void run_fork() const;
     void run_thread_pool() const;
     void run_thread_request() const;
+
+    /**
+     * Forks -W long-lived workers that each accept and answer connections one at a time,
+     * then sits back as their supervisor and forks a replacement whenever one exits,
+     * whether it crashed or was recycled after --max-requests-per-worker.
+    **/
+    void run_prefork() const;
+
+    /**
+     * Serves every connection from a single thread with non-blocking sockets and
+     * edge-triggered epoll. A connection only costs its buffers while it waits on the client.
+    **/
+    void run_event_loop() const;
+
+    /**
+     * Like run_event_loop(), but all socket I/O goes through an io_uring: one multishot
+     * accept, multishot receives into kernel-provided buffers, and sends (file bodies
+     * as linked read + send chains on registered files) submitted in batches.
+     * Throws a ConfigError at startup if the kernel can not do this.
+    **/
+    void run_io_uring() const;
 };
 
 #endif
@@ -2,17 +2,174 @@
 #define CS252_TCPCONNECTION_H
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <sys/uio.h>
+#include <sys/types.h>
 
 #include "Config.hpp"
+#include "http/HttpParser.hpp"
+#include "http/BodyDecoder.hpp"
+#include "server/BodySpool.hpp"
 
 class TcpConnection
 {
+public:
+    /**
+     * A write waiting in the output queue. It is either a run of bytes (fd == -1,
+     * offset counts how many of them have been written already) or count bytes of
+     * the file fd starting at offset, in which case the entry owns fd.
+     * The bytes are a copy in data, or for putref() memory that keep holds on to.
+    **/
+    struct PendingWrite
+    {
+        std::string data;
+        std::shared_ptr<void const> keep;
+        std::string_view shared;
+        int fd;
+        off_t offset;
+        size_t count;
+
+        std::string_view bytes() const noexcept
+        {
+            return keep != nullptr ? shared : std::string_view(data);
+        }
+    };
 private:
     Config const& m_config;
     int m_master;
     int m_conn;
     bool m_shutdown;
+
+    /**
+     * Receive buffer for m_conn.
+     * Bytes in [m_rpos, m_rend) have been read from the socket but not yet consumed
+     * by the parser. The buffer lives as long as the connection, so anything a client
+     * sends past the end of one request is still there for the next one.
+    **/
+    std::vector<char> m_rbuf;
+    size_t m_rpos;
+    size_t m_rend;
+
+    /**
+     * Initial size of m_rbuf. It only grows past this if a single read_until()
+     * is asked to look further than the buffer can hold.
+    **/
+    static size_t const m_rbuf_size = 8192;
+
+    /**
+     * receive() stops reading once this much is buffered and waits for the parser to catch up.
+    **/
+    static size_t const m_rbuf_max = 65536;
+
+    bool m_nonblocking;
+    bool m_deferred;
+    bool m_shutdown_pending;
+    bool m_receive_stalled;
+    bool m_batching;
+
+    /**
+     * Number of requests started on this connection, see count_request().
+    **/
+    int m_requests;
+
+    /**
+     * In non-blocking mode, writes that the kernel can not take right away are queued here
+     * in order and written out by flush(). In deferred and batching mode every write ends up here.
+    **/
+    std::deque<PendingWrite> m_wqueue;
+
+    /**
+     * Makes room for at least one more byte at the end of m_rbuf by dropping
+     * consumed bytes, growing the buffer if it is completely full.
+    **/
+    void make_room();
+
+    /**
+     * Reads as many bytes as the kernel has ready (at least one) into m_rbuf,
+     * compacting or growing the buffer first if there is no room at the end.
+     * Returns false if the peer closed the connection or the read failed.
+    **/
+    bool fill();
+
+    /**
+     * When reads in blocking mode have to give up, on the monotonic clock in milliseconds.
+     * -1 if they may wait forever.
+    **/
+    long m_read_deadline;
+
+    /**
+     * Memory for everything a request and its response allocate. It is handed out front
+     * to back and taken back all at once by reset_arena() once the request is answered.
+     * The first m_arena_size bytes come with the connection (and survive its recycling),
+     * so a typical request never goes to the heap for them.
+    **/
+    static size_t const m_arena_size = 8192;
+    std::unique_ptr<char[]> m_arena_buffer;
+    std::pmr::monotonic_buffer_resource m_arena;
+
+    /**
+     * Parses the head of the request at the front of the receive buffer. It lives with the
+     * connection so that parsing picks up where it left off whenever more bytes arrive.
+    **/
+    HttpParser m_parser;
+
+    /**
+     * The framing of the current request's body and, in the event loops, the part of it that
+     * has been taken out of the receive buffer ahead of the handler. Bodies larger than
+     * m_spool_memory go to disk.
+    **/
+    static size_t const m_spool_memory = 65536;
+    BodyDecoder m_body;
+    BodySpool m_spool;
+
+    /**
+     * Polls m_conn for events for up to timeout_ms milliseconds (forever if negative).
+     * Returns false if the time ran out first.
+    **/
+    bool wait_for(short events, int timeout_ms);
+
+    /**
+     * Blocks until m_conn is writable again. Used when a write reports EAGAIN in blocking mode.
+     * Throws a TimeoutError if the client has not made room within the write timeout.
+    **/
+    void wait_writable();
+
+    /**
+     * Sets or clears TCP_CORK, see cork().
+    **/
+    void setcork(bool on);
+
+    /**
+     * Appends whatever is left in iov to m_wqueue.
+    **/
+    void queue(struct iovec const* iov, int iovcnt);
+
+    /**
+     * Queues count bytes of fd starting at offset. fd is dup()ed, so the caller keeps its own.
+    **/
+    void queue_file(int fd, off_t offset, size_t count);
+
+    /**
+     * Queues size bytes at buf without copying them, holding on to keep until they are written.
+    **/
+    void queue_ref(std::shared_ptr<void const> keep, char const* buf, size_t size);
+
+    /**
+     * Recycling for acquire() and release(): reset() starts the connection over on conn_fd,
+     * keeping the receive buffer and queue it already has, and close_socket() drops whatever
+     * is queued and closes the socket. A released connection has m_conn == -1.
+    **/
+    void reset(int conn_fd);
+    void close_socket() noexcept;
 public:
+    /**
+     * Tag for the constructor that takes over a socket somebody else already accepted.
+    **/
+    struct Adopt {};
     /**
      * :: TODO ::
      * TcpConnection() calls accept() to acquire a child connection
@@ -20,18 +177,178 @@ public:
     **/
     TcpConnection(Config const& config, int master_fd);
 
+    /**
+     * Wraps conn_fd, which has already been accepted, instead of calling accept() itself.
+    **/
+    TcpConnection(Config const& config, int conn_fd, Adopt);
+
     /**
      * Destructors should release resources acquired in the constructor,
      * so we should close m_conn hre
     **/
     ~TcpConnection() noexcept;
 
+    /**
+     * Connections and their buffers are recycled through a free list per thread, so once a
+     * thread has served a few connections, taking on another does not allocate.
+     * acquire() wraps conn_fd, which has already been accepted, like the Adopt constructor,
+     * and accept() accepts one on master_fd first. Both throw a ConnectionError if that fails.
+     * release() closes the socket and keeps the connection for the thread's next acquire().
+     * Every connection must come from the config the server runs with.
+    **/
+    static TcpConnection* acquire(Config const& config, int conn_fd);
+    static TcpConnection* accept(Config const& config, int master_fd);
+    static void release(TcpConnection* conn) noexcept;
+
     /**
      * Call shutdown on the connection - see `man 2 shutdown`.
      * Think about why we don't do this in the destructor.
+     * If output is still queued, the shutdown happens once flush() has written it.
     **/
     void shutdown();
 
+    /**
+     * The underlying socket, for registering with poll()/epoll.
+    **/
+    int fd() const noexcept;
+
+    /**
+     * Puts the connection in non-blocking mode. The socket itself never blocks, so that
+     * blocking mode can wait for it with a timeout; in non-blocking mode nothing waits at all.
+     * Reads then only ever come from receive(), and writes the kernel can not take
+     * right away are queued for flush() instead of blocking the caller.
+    **/
+    void set_nonblocking() noexcept;
+
+    /**
+     * Non-blocking mode only: reads everything the kernel has ready into the receive buffer,
+     * stopping at EAGAIN (or when the buffer holds m_rbuf_max bytes, see receive_stalled()).
+     * Returns false once the peer has closed the connection or reading failed;
+     * bytes read before that are still buffered.
+    **/
+    bool receive();
+
+    /**
+     * True if the last receive() stopped because the buffer was full rather than because
+     * the socket was drained, meaning it should be called again once the buffer is consumed.
+    **/
+    bool receive_stalled() const noexcept;
+
+    /**
+     * The bytes that have been received but not consumed yet.
+    **/
+    char const* buffered_data() const noexcept;
+    size_t buffered_size() const noexcept;
+
+    /**
+     * Drops the first size buffered bytes, once whoever looked at them is done with them.
+    **/
+    void consume(size_t size) noexcept;
+
+    /**
+     * Reads at least one more byte into the receive buffer, waiting for it in blocking mode
+     * (see set_read_deadline()). Buffered bytes may move to the front of the buffer, but stay
+     * in order. Returns false if nothing more can be read, like receive().
+    **/
+    bool read_more();
+
+    /**
+     * The parser for the request at the front of the receive buffer, see m_parser.
+    **/
+    HttpParser& parser() noexcept;
+
+    /**
+     * The body of the current request, see m_body and m_spool. reset_body() gets both
+     * ready for the next request.
+    **/
+    BodyDecoder& body_decoder() noexcept;
+    BodySpool& spool() noexcept;
+    void reset_body() noexcept;
+
+    /**
+     * Drops size buffered bytes starting offset bytes in, keeping the ones before and after.
+     * Lets a body be set aside while the head in front of it stays where the parser saw it.
+    **/
+    void erase_buffered(size_t offset, size_t size) noexcept;
+
+    /**
+     * Writes as much of the queued output as the kernel will take, which in blocking mode is all of it.
+     * Returns true once everything has been written (and a deferred shutdown() carried out).
+     * Throws a ConnectionError if the connection can not be written to.
+    **/
+    bool flush();
+
+    /**
+     * True while queued output is waiting for flush().
+    **/
+    bool pending_output() const noexcept;
+
+    /**
+     * How many bytes are still queued, counting file bodies at their full size.
+    **/
+    size_t pending_bytes() const noexcept;
+
+    /**
+     * Puts the connection in deferred mode, for servers that do their own socket I/O
+     * (such as through io_uring). The connection then never touches the socket for data:
+     * incoming bytes are handed over with append_received() and everything written to it
+     * is queued, to be taken off with next_pending() and pop_pending().
+     * Implies non-blocking mode.
+    **/
+    void set_deferred();
+
+    /**
+     * While batching, writes are queued instead of written, so that the responses to
+     * several pipelined requests go out together on the next flush().
+    **/
+    void batch(bool on) noexcept;
+
+    /**
+     * Deferred mode only: adds bytes that arrived on the socket to the receive buffer.
+    **/
+    void append_received(char const* data, size_t size);
+
+    /**
+     * Deferred mode only: the oldest queued write (nullptr if there is none), and a way
+     * to drop it once the server has written all of it.
+    **/
+    PendingWrite* next_pending() noexcept;
+    void pop_pending() noexcept;
+
+    /**
+     * True once shutdown() has been called, even if it is deferred behind queued output.
+    **/
+    bool is_shutdown() const noexcept;
+
+    /**
+     * Counts one more request on this connection and returns how many it has carried,
+     * including this one. The server uses it to cap requests per kept-alive connection.
+    **/
+    int count_request() noexcept;
+    int request_count() const noexcept;
+
+    /**
+     * Blocking mode only: reads that need more bytes from the client throw a TimeoutError
+     * once timeout_ms milliseconds have passed from now. The deadline covers every read
+     * until the next call, so a client can not stretch it by trickling in a byte at a time.
+     * A negative timeout_ms lifts the deadline.
+    **/
+    void set_read_deadline(int timeout_ms);
+
+    /**
+     * The arena that requests and responses on this connection allocate from, and a way to
+     * free everything in it. Nothing allocated from the arena may outlive the request.
+    **/
+    std::pmr::memory_resource* arena() noexcept;
+    void reset_arena() noexcept;
+
+    /**
+     * Blocks for up to timeout_ms milliseconds until there is something to read:
+     * either bytes already buffered, new bytes from the client, or the client closing.
+     * Returns false if the time ran out first.
+    **/
+    bool wait_readable(int timeout_ms);
+
     /**
      * :: TODO ::
      * Gets a single byte from m_conn and stores it in *c.
@@ -39,6 +356,25 @@ public:
     **/
     bool getc(unsigned char* c);
 
+    /**
+     * Same as getc(), but leaves the byte in the receive buffer.
+    **/
+    bool peek(unsigned char* c);
+
+    /**
+     * Consumes bytes up to and including the first occurrence of delim and stores them in line.
+     * At most max bytes are consumed; if delim has not been seen by then, line holds those
+     * max bytes without a trailing delim and the rest stays buffered.
+     * Returns false if the connection closed before either happened.
+    **/
+    bool read_until(std::string const& delim, std::pmr::string& line, size_t max);
+
+    /**
+     * Consumes exactly bufsize bytes into buf, reading from m_conn only as needed.
+     * Returns false if the connection closed first.
+    **/
+    bool read_exact(void* buf, size_t bufsize);
+
     /**
      * :: TODO ::
      * Writes a single byte to m_conn.
@@ -49,13 +385,44 @@ public:
      * :: TODO ::
      * Convenience method to write an entire string to the connection.
     **/
-    void puts(std::string const& str);
+    void puts(std::string_view str);
 
     /**
      * :: TODO ::
      * Convenience method to write an entire buffer to the connection.
     **/
     void putbuf(void const* buf, size_t bufsize);
+
+    /**
+     * Writes every buffer in iov to the connection with as few writev() calls as possible,
+     * picking up where the kernel left off after short writes and waiting out EAGAIN.
+     * iov is modified in place while the write is in progress.
+     * Throws a ConnectionError if the connection can not be written to.
+    **/
+    void putv(struct iovec* iov, int iovcnt);
+
+    /**
+     * Like putbuf(), for memory that keep owns, such as a file mapping. Whatever can not be
+     * written right away is queued by reference instead of copied, so buf is only ever read
+     * by the kernel: if it is a mapping of a file that has shrunk, the write fails with
+     * EFAULT (a ConnectionError) where reading it here would have raised SIGBUS.
+    **/
+    void putref(std::shared_ptr<void const> keep, void const* buf, size_t size);
+
+    /**
+     * Sends count bytes of the file fd, starting at offset, straight from the page cache
+     * with sendfile(2). If the kernel can not sendfile() from fd, falls back to copying
+     * the file through a small userspace buffer.
+     * Throws a ConnectionError if the connection can not be written to.
+    **/
+    void sendfile(int fd, off_t offset, size_t count);
+
+    /**
+     * Turns TCP_CORK on or off for the connection.
+     * While corked, the kernel only sends full segments, so separately written headers
+     * and bodies still end up sharing packets. Uncorking flushes whatever is left.
+    **/
+    void cork(bool on);
 };
 
-#endif
\ No newline at end of file
+#endif
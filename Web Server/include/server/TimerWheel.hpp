@@ -0,0 +1,78 @@
+#ifndef CS252_TIMERWHEEL_H
+#define CS252_TIMERWHEEL_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * A hashed timer wheel for the event loops, which can have many thousands of connections
+ * with a deadline each. Time is cut into ticks and every timer hangs off the slot of the
+ * tick it expires in, so scheduling and cancelling are O(1) and each tick only looks at
+ * the timers in one slot. Timers further out than one turn of the wheel just stay in their
+ * slot until a later turn.
+**/
+class TimerWheel
+{
+public:
+    /**
+     * A timer lives inside whatever it times out and unlinks itself when it is destroyed,
+     * so the owner can be deleted without telling the wheel.
+     * data is for the owner to find itself again when the timer expires.
+    **/
+    class Timer
+    {
+    public:
+        void* data;
+
+        Timer() noexcept;
+        ~Timer() noexcept;
+        Timer(Timer const&) = delete;
+        Timer& operator=(Timer const&) = delete;
+
+        bool armed() const noexcept;
+        void cancel() noexcept;
+    private:
+        friend class TimerWheel;
+
+        // armed timers are linked into a circular list with their slot's sentinel
+        Timer* m_prev;
+        Timer* m_next;
+        TimerWheel* m_wheel;
+        long m_expires;
+    };
+
+    /**
+     * tick_ms is the resolution of the wheel, slots how many ticks one turn covers.
+    **/
+    TimerWheel(int tick_ms, size_t slots);
+
+    /**
+     * (Re)arms timer to expire timeout_ms milliseconds from now.
+    **/
+    void schedule(Timer& timer, int timeout_ms);
+
+    /**
+     * How long an event loop may sleep before the next tick is due,
+     * or -1 if no timer is armed.
+    **/
+    int next_timeout_ms() const noexcept;
+
+    /**
+     * Disarms every timer that is due and appends it to expired.
+    **/
+    void expire(std::vector<Timer*>& expired);
+
+    /**
+     * Milliseconds on the monotonic clock.
+    **/
+    static long now_ms() noexcept;
+private:
+    int m_tick_ms;
+    size_t m_slots;
+    std::unique_ptr<Timer[]> m_wheel;
+    long m_last_tick;
+    size_t m_armed;
+};
+
+#endif
@@ -0,0 +1,13 @@
+# how many sockets the script was left with, which should be none of the server's
+count=0
+for fd in /proc/$$/fd/*; do
+    if [[ $(readlink $fd) == socket:* ]]; then
+        count=$((count + 1))
+    fi
+done
+
+printf "HTTP/1.0 200 OK\r\n"
+printf "Connection: close\r\n"
+printf "Content-Length: ${#count}\r\n"
+printf "Content-Type: text/plain\r\n\r\n"
+printf "$count"
@@ -0,0 +1,17 @@
+# each uploaded file as its field name and contents, and where it was saved in a header
+out=$(mktemp)
+printenv | grep "^HTTP:FILE:" | sort | while IFS="=" read -r name path; do
+    echo "${name#HTTP:FILE:}"
+    cat "$path"
+done > $out
+paths=$(printenv | grep "^HTTP:FILE:" | sort | cut -d "=" -f 2- | tr "\n" " ")
+
+content_length=$(wc -c < $out)
+
+printf "HTTP/1.0 200 OK\r\n"
+printf "Connection: close\r\n"
+printf "Content-Length: $content_length\r\n"
+printf "Content-Type: text/plain\r\n"
+printf "X-Upload-Paths: $paths\r\n\r\n"
+cat $out
+rm -f $out
@@ -0,0 +1,62 @@
+#include <new>
+#include <cstdlib>
+
+#include "AllocationCounter.hpp"
+
+#ifdef COUNT_ALLOCATIONS
+
+static thread_local unsigned long allocation_count = 0;
+
+/**
+ * The default operator new[] and operator delete[] forward to these two,
+ * so array allocations are counted as well.
+**/
+void* operator new(std::size_t size)
+{
+    allocation_count++;
+
+    if (size == 0)
+    {
+        size = 1;
+    }
+
+    while (true)
+    {
+        void* ptr = std::malloc(size);
+        if (ptr != nullptr)
+        {
+            return ptr;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+unsigned long allocations() noexcept
+{
+    return allocation_count;
+}
+
+#else
+
+unsigned long allocations() noexcept
+{
+    return 0;
+}
+
+#endif
@@ -5,6 +5,16 @@
 #include "Config.hpp"
 #include "error/ConfigError.hpp"
 
+int Config::parse_timeout(char const* optarg, std::string const& phase)
+{
+    int seconds = strtol(optarg, NULL, 10);
+    if (seconds < 1 || seconds > 3600)
+    {
+        throw ConfigError("Invalid " + phase + " timeout");
+    }
+    return seconds;
+}
+
 void Config::set_opt(int shortopt, char const* optarg)
 {
     switch (shortopt)
@@ -34,7 +44,7 @@ void Config::set_opt(int shortopt, char const* optarg)
         break;
     case 'P':
         threads = strtol(optarg, NULL, 10);
-        if (threads < 1 || threads > 10)
+        if (threads < 1)
         {
             throw ConfigError("Invalid number of threads for a thread pool");
         }
@@ -43,8 +53,108 @@ void Config::set_opt(int shortopt, char const* optarg)
     case 'F':
     case 'R':
     case 'L':
+    case 'E':
+    case 'U':
         mode = (Config::Mode) shortopt;
         break;
+    case 'W':
+        workers = strtol(optarg, NULL, 10);
+        if (workers < 1)
+        {
+            throw ConfigError("Invalid number of pre-forked workers");
+        }
+        mode = SM_PREFORK;
+        break;
+    case LO_REUSEPORT:
+        reuseport = true;
+        break;
+    case LO_KEEPALIVE_TIMEOUT:
+        keep_alive_timeout = parse_timeout(optarg, "keep-alive");
+        break;
+    case LO_MAX_REQUESTS:
+        max_requests = strtol(optarg, NULL, 10);
+        if (max_requests < 1)
+        {
+            throw ConfigError("Invalid maximum number of requests per connection");
+        }
+        break;
+    case LO_HEADER_TIMEOUT:
+        header_timeout = parse_timeout(optarg, "header");
+        break;
+    case LO_BODY_TIMEOUT:
+        body_timeout = parse_timeout(optarg, "body");
+        break;
+    case LO_WRITE_TIMEOUT:
+        write_timeout = parse_timeout(optarg, "write");
+        break;
+    case LO_QUEUE_CAPACITY:
+        queue_capacity = strtol(optarg, NULL, 10);
+        if (queue_capacity < 1 || queue_capacity > (1 << 20))
+        {
+            throw ConfigError("Invalid queue capacity");
+        }
+        break;
+    case LO_ACCEPTORS:
+        acceptors = strtol(optarg, NULL, 10);
+        if (acceptors < 1)
+        {
+            throw ConfigError("Invalid number of acceptor threads");
+        }
+        break;
+    case LO_STATS:
+        stats_interval = strtol(optarg, NULL, 10);
+        if (stats_interval < 0)
+        {
+            throw ConfigError("Invalid stats interval");
+        }
+        break;
+    case LO_WORKER_REQUESTS:
+        worker_requests = strtol(optarg, NULL, 10);
+        if (worker_requests < 0)
+        {
+            throw ConfigError("Invalid number of requests per worker");
+        }
+        break;
+    case LO_HANDOFF:
+        handoff = true;
+        break;
+    case LO_MAX_BODY:
+        max_body = strtol(optarg, NULL, 10);
+        if (max_body < 0)
+        {
+            throw ConfigError("Invalid maximum body size");
+        }
+        break;
+    case LO_UPLOAD_DIR:
+        upload_dir = optarg;
+        break;
+    case LO_MIME_TYPES:
+        mime_types = optarg;
+        break;
+    case LO_FILE_CACHE:
+        file_cache = strtol(optarg, NULL, 10);
+        if (file_cache < 0)
+        {
+            throw ConfigError("Invalid file cache size");
+        }
+        break;
+    case LO_MMAP_FILES:
+        mmap_files = strtol(optarg, NULL, 10);
+        if (mmap_files < 0)
+        {
+            throw ConfigError("Invalid number of mapped files");
+        }
+        break;
+    case LO_OPEN_FILES:
+        open_files = strtol(optarg, NULL, 10);
+        if (open_files < 0)
+        {
+            throw ConfigError("Invalid number of open files");
+        }
+        break;
+    case LO_OPEN_FILE_TTL:
+        open_file_ttl = parse_timeout(optarg, "open file");
+        break;
     case '?':
         throw ConfigError(std::string("Unknown option ") + (char) optopt);
     default:
@@ -67,12 +177,33 @@ Config::Config(int argc, char** argv)
         {"pool-thread", required_argument, 0, 'P'},
         {"request-thread", no_argument, 0, 'R'},
         {"linear", no_argument, 0, 'L'},
+        {"event-loop", no_argument, 0, 'E'},
+        {"io-uring", no_argument, 0, 'U'},
+        {"prefork", required_argument, 0, 'W'},
+        {"reuseport", no_argument, 0, LO_REUSEPORT},
+        {"keep-alive-timeout", required_argument, 0, LO_KEEPALIVE_TIMEOUT},
+        {"max-requests", required_argument, 0, LO_MAX_REQUESTS},
+        {"header-timeout", required_argument, 0, LO_HEADER_TIMEOUT},
+        {"body-timeout", required_argument, 0, LO_BODY_TIMEOUT},
+        {"write-timeout", required_argument, 0, LO_WRITE_TIMEOUT},
+        {"queue-capacity", required_argument, 0, LO_QUEUE_CAPACITY},
+        {"acceptors", required_argument, 0, LO_ACCEPTORS},
+        {"stats", required_argument, 0, LO_STATS},
+        {"max-requests-per-worker", required_argument, 0, LO_WORKER_REQUESTS},
+        {"handoff", no_argument, 0, LO_HANDOFF},
+        {"max-body-size", required_argument, 0, LO_MAX_BODY},
+        {"upload-dir", required_argument, 0, LO_UPLOAD_DIR},
+        {"mime-types", required_argument, 0, LO_MIME_TYPES},
+        {"file-cache-size", required_argument, 0, LO_FILE_CACHE},
+        {"mmap-files", required_argument, 0, LO_MMAP_FILES},
+        {"open-file-cache", required_argument, 0, LO_OPEN_FILES},
+        {"open-file-ttl", required_argument, 0, LO_OPEN_FILE_TTL},
         {0, 0, 0, 0}
     };
     int cl_option_index;
     int shortopt;
 
-    char const* gopt_fmt = "vp:e:s:q:FP:RL";
+    char const* gopt_fmt = "vp:e:s:q:FP:RLEUW:";
 
     while ((shortopt = getopt_long(argc, argv, gopt_fmt, cl_options, &cl_option_index)) != -1)
     {
@@ -90,6 +221,19 @@ Config::Config(int argc, char** argv)
             set_opt(shortopt, optarg);
         }
     }
+
+    if (reuseport && mode != SM_POOLTHREAD && mode != SM_PREFORK)
+    {
+        throw ConfigError("--reuseport needs a pool of threads (-P) or pre-forked workers (-W) to give listeners to");
+    }
+    if (handoff && mode != SM_PREFORK)
+    {
+        throw ConfigError("--handoff needs pre-forked workers (-W) to hand connections to");
+    }
+    if (handoff && reuseport)
+    {
+        throw ConfigError("--handoff accepts on a single listener and can not be used with --reuseport");
+    }
 }
 
 void Config::print() const
@@ -110,6 +254,30 @@ void Config::print() const
     if (mode == SM_POOLTHREAD)
     {
         std::cout << "\tMode: pool of threads (" << threads << " total)" << std::endl;
+        if (reuseport)
+        {
+            std::cout << "\tListeners: one per thread (SO_REUSEPORT)" << std::endl;
+        }
+        else
+        {
+            std::cout << "\tQueue: " << queue_capacity << " connections, " << acceptors << " acceptor(s)" << std::endl;
+        }
+    }
+    else if (mode == SM_PREFORK)
+    {
+        std::cout << "\tMode: pre-forked workers (" << workers << " total)" << std::endl;
+        if (reuseport)
+        {
+            std::cout << "\tListeners: one per worker (SO_REUSEPORT)" << std::endl;
+        }
+        else if (handoff)
+        {
+            std::cout << "\tListeners: one, handing connections to the least loaded worker" << std::endl;
+        }
+        if (worker_requests > 0)
+        {
+            std::cout << "\tWorkers: recycled after " << worker_requests << " requests" << std::endl;
+        }
     }
     else if (mode == SM_REQUESTTHREAD)
     {
@@ -119,8 +287,26 @@ void Config::print() const
     {
         std::cout << "\tMode: process-per-request" << std::endl;
     }
+    else if (mode == SM_EVENTLOOP)
+    {
+        std::cout << "\tMode: event loop (epoll)" << std::endl;
+    }
+    else if (mode == SM_IOURING)
+    {
+        std::cout << "\tMode: event loop (io_uring)" << std::endl;
+    }
     else
     {
         std::cout << "\tMode: linear/iterative" << std::endl;
     }
+    if (max_requests > 1)
+    {
+        std::cout << "\tKeep-alive: " << keep_alive_timeout << "s idle, up to " << max_requests << " requests" << std::endl;
+    }
+    else
+    {
+        std::cout << "\tKeep-alive: off" << std::endl;
+    }
+    std::cout << "\tTimeouts: header " << header_timeout << "s, body " << body_timeout << "s, write " << write_timeout << "s" << std::endl;
+    std::cout << "\tRequest bodies: up to " << max_body << " bytes, uploads in " << upload_dir << std::endl;
 }
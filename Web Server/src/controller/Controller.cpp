@@ -1,6 +1,7 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
 #include <stdexcept>
 #include <limits.h>
 
@@ -56,13 +57,15 @@ void Controller::send_error_response(Config const& config, TcpConnection* conn,
     }
 }
 
-bool Controller::resolve_requested_path(std::string const& requested, std::string const& basedir, std::string& resolved) const noexcept
+bool Controller::resolve_requested_path(std::string_view requested, std::string const& basedir, std::string& resolved) const noexcept
 {
   char resolved_basedir[PATH_MAX + 1];
-  realpath(basedir.c_str(), resolved_basedir);
-
   char resolved_path[PATH_MAX + 1];
-  realpath((basedir + requested).c_str(), resolved_path);
+  if (realpath(basedir.c_str(), resolved_basedir) == NULL
+      || realpath((basedir + std::string(requested)).c_str(), resolved_path) == NULL)
+  {
+    return false;
+  }
 
   std::string r_basedir = resolved_basedir;
   std::string r_path    = resolved_path;
@@ -72,6 +75,7 @@ bool Controller::resolve_requested_path(std::string const& requested, std::strin
     return true;
   }
 
+  errno = ENOENT;
   return false;
   
   //throw TodoError("4", "You need to implement resolving request paths");
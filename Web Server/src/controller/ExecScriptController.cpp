@@ -6,6 +6,10 @@
 #include <climits>
 #include <cstdlib>
 #include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 
 #include "Config.hpp"
 #include "Utils.hpp"
@@ -13,10 +17,28 @@
 #include "controller/ExecScriptController.hpp"
 #include "server/Request.hpp"
 #include "server/Response.hpp"
+#include "server/TimerWheel.hpp"
 #include "http/HttpStatus.hpp"
 #include "error/ControllerError.hpp"
+#include "error/RequestError.hpp"
 #include "error/TodoError.hpp"
 
+extern char** environ;
+
+// what a script may write before it is killed, which keeps a runaway one from taking all of memory
+static size_t const max_output = 8 << 20;
+
+ExecScriptController::Script::~Script()
+{
+  for (std::string const& upload : uploads)
+  {
+    if (unlink(upload.c_str()) == -1)
+    {
+      d_warnf("Could not remove upload %s", upload.c_str());
+    }
+  }
+}
+
 ExecScriptController::ExecScriptController(Config const& config, std::string const& ignore) :
     Controller(config),
     m_ignore(ignore)
@@ -26,156 +48,232 @@ ExecScriptController::ExecScriptController(Config const& config, std::string con
 
 void ExecScriptController::run(Request const& req, Response& res) const
 {
-  std::string resolved_path;
-  std::string path = req.get_path().substr(m_ignore.length());
-  if (Controller::resolve_requested_path(path, m_config.exec_dir, resolved_path) == false)
-    {
-      Controller::send_error_response(res, HttpStatus::NotFound, path + " could not be found\n");
-    }
+  std::unique_ptr<Script> script = prepare(req, res);
+  if (script == nullptr)
+  {
+    return;
+  }
 
-  // open the file to get the size and contents of the file and close it. Send the response
-  std::fstream fs;
-  fs.open(resolved_path, std::fstream::in | std::fstream::binary);
+  execute(*script);
+  respond(*script, res);
+}
 
-  if (fs.is_open())
+std::unique_ptr<ExecScriptController::Script> ExecScriptController::prepare(Request const& req, Response& res) const
+{
+  // scripts get form fields, so a body has to be a form
+  if (req.get_method() == "POST" && !req.content_type_is("application/x-www-form-urlencoded")
+      && !req.content_type_is("multipart/form-data"))
   {
-      int size      = get_content_length(fs);
-      char *content = (char *) malloc(size + 1);
-      fs.clear();
-      fs.seekp(fs.beg);
-      fs.read(content, size);
-      content[size] = '\0';
-      fs.close();
-      //set_environment(req);
-      res.set_status(HttpStatus::Ok);
-      res.set_header("Content-Type", get_content_type(resolved_path, req));
-      res.set_header("Content-Length", std::to_string(size));
-      res.send(content, size);
+    throw RequestError(HttpStatus::UnsupportedMediaType, "Unsupported media type\n");
+  }
 
-      free(content);
+  std::unique_ptr<Script> script(new Script());
+  script->path = std::string_view(req.get_path()).substr(m_ignore.length());
+  bool resolved = Controller::resolve_requested_path(script->path, m_config.exec_dir, script->resolved);
+  if (!resolved && errno == EACCES)
+  {
+    Controller::send_error_response(res, HttpStatus::Forbidden, script->path + " may not be accessed\n");
+    return nullptr;
   }
-  else
+  if (!resolved || access(script->resolved.c_str(), X_OK) == -1)
   {
-      Controller::send_error_response(res, HttpStatus::NotFound, path + " could not be found\n");
+    Controller::send_error_response(res, HttpStatus::NotFound, script->path + " could not be found\n");
+    return nullptr;
   }
-  //throw TodoError("4", "You need to implement SendFileController");
-}
 
-int ExecScriptController::get_content_length(std::fstream& fs) const
-{
-  int length = 0;
-  while (fs.get() != EOF)
+  // the script gets the whole form, so it is read and any uploads saved before it starts
+  set_environment(req, script->env);
+  for (Request::Upload& upload : req.take_uploads())
   {
-      length++;
+    script->uploads.push_back(std::move(upload.path));
   }
 
-  return length;
-  //throw TodoError("4", "You need to implement getting the length of a file");
+  return script;
 }
-  //throw TodoError("6", "You need to implement ExecScriptController");
 
-bool ExecScriptController::set_environment(Request const& req) const noexcept
+void ExecScriptController::execute(Script& script) const
 {
-  std::string http = "HTTP:";
-  if (setenv((http + "METHOD=").c_str(), req.get_method().c_str(), 1) == -1) return false;
-  if (setenv((http + "PATH=").c_str(), req.get_path().c_str(), 1) == -1)     return false;
-
-  if (set_var(req.get_headers(), http + "HEADER:") == false) return false;
-  if (set_var(req.get_query(), http + "QUERY:") == false)    return false;
-  if (set_var(req.get_body(), http + "BODY:") == false)      return false;
+  // everything the child needs is put together first, since a child of a threaded server may only exec
+  std::vector<char*> envp;
+  for (std::string& var : script.env)
+  {
+    envp.push_back(&var[0]);
+  }
+  envp.push_back(nullptr);
+  char* argv[] = { &script.resolved[0], nullptr };
+  char* bash_argv[] = { (char*) "bash", &script.resolved[0], nullptr };
 
-  return true;
-  //throw TodoError("6", "You need to implement setting environment variables for the child process");
-}
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC) == -1)
+  {
+    d_warnf("Could not create a pipe for %s: %s", script.path.c_str(), strerror(errno));
+    return;
+  }
 
-bool ExecScriptController::set_var(std::unordered_map<std::string, std::string>  mapping, std::string key) const
-{
-  for (auto const& element : mapping)
+  pid_t pid = fork();
+  if (pid == -1)
   {
-    if (setenv((key + element.first + "=").c_str(), element.second.c_str(), 1) == -1) return false;
+    d_warnf("Could not fork for %s: %s", script.path.c_str(), strerror(errno));
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return;
   }
 
-  return true;
-}
-std::string ExecScriptController::get_content_type(std::string const& filename, Request const& req) const
-{
-  int child_stdout[2];
-  if (pipe(child_stdout) == -1)
+  if (pid == 0)
+  {
+    // the script writes to the pipe, every other descriptor of the server closes on exec.
+    // It gets a process group of its own, so that whatever it starts can be killed with it
+    if (dup2(pipefd[1], STDOUT_FILENO) == -1 || setpgid(0, 0) == -1) _exit(127);
+
+    execve(argv[0], argv, envp.data());
+
+    // scripts without a #! line go to bash, since not every /bin/sh passes on variables
+    // with a ':' in their name
+    if (errno == ENOEXEC)
     {
-      throw ControllerError("Could not create pipe to communicate with `xdg-mime`");
+      execve("/bin/bash", bash_argv, envp.data());
     }
+    _exit(127);
+  }
 
-  d_printf("Getting content type. child_stdout = {%d, %d}", child_stdout[0], child_stdout[1]);
+  close(pipefd[1]);
+  setpgid(pid, pid);
 
-  pid_t child = fork();
-  if (child == -1)
+  // the script has as long as a client gets to take some of a response, then it is killed
+  long deadline = TimerWheel::now_ms() + m_config.write_timeout * 1000L;
+  bool failed = false;
+  char buf[4096];
+  while (true)
+  {
+    long wait = deadline - TimerWheel::now_ms();
+    struct pollfd pfd = { pipefd[0], POLLIN, 0 };
+    int ready = wait > 0 ? poll(&pfd, 1, wait) : 0;
+    if (ready == 0)
     {
-      throw ControllerError("Could not create child process to find MIME type");
+      d_warnf("%s did not finish within %d seconds", script.path.c_str(), m_config.write_timeout);
+      failed = true;
+      break;
     }
-  if (child == 0)
+
+    ssize_t n = ready == -1 ? -1 : read(pipefd[0], buf, sizeof(buf));
+    if (n == -1)
     {
-      if (dup2(child_stdout[1], STDOUT_FILENO) == -1)
-	{
-	  exit(1);
-	}
-      set_environment(req);
-      execlp("xdg-mime", "xdg-mime", "query", "filetype", filename.c_str(), 0);
-      exit(1);
+      if (errno == EINTR) continue;
+      d_warnf("Could not read the output of %s: %s", script.path.c_str(), strerror(errno));
+      failed = true;
+      break;
     }
-
-  if (close(child_stdout[1]) == -1)
+    if (n == 0)
+    {
+      break;
+    }
+    if (script.output.size() + n > max_output)
     {
-      throw ControllerError("Could not close pipe input");
+      d_warnf("%s wrote more than %zu bytes", script.path.c_str(), max_output);
+      failed = true;
+      break;
     }
+    script.output.append(buf, n);
+  }
+  close(pipefd[0]);
+
+  if (failed)
+  {
+    kill(-pid, SIGKILL);
+  }
 
+  // a script that closed its output may still be on its way out, but it does not get past the deadline
   int status;
-  if (waitpid(child, &status, 0) == -1)
+  pid_t waited;
+  while ((waited = waitpid(pid, &status, failed ? 0 : WNOHANG)) != pid)
+  {
+    if (waited == -1 && errno != EINTR)
     {
-      throw ControllerError("Error while waiting for finding MIME type to finish");
+      return;
     }
-
-  if ((WIFEXITED(status) && WEXITSTATUS(status) != 0) || WIFSIGNALED(status))
+    if (waited == 0 && TimerWheel::now_ms() >= deadline)
     {
-      throw ControllerError("`xdg-mime` exited with errors");
+      d_warnf("%s did not finish within %d seconds", script.path.c_str(), m_config.write_timeout);
+      failed = true;
+      kill(-pid, SIGKILL);
     }
-
-  //size_t const max_content_length = 50;
-  //char buf[max_content_length];
-  //memset(buf, 0, max_content_length);
-  char *buf = (char *) malloc(5000);
-  char *c   = NULL;
-  int res   = read(child_stdout[0], c, 1);;
-  int count = 0;
-  int x     = 1;
-  
-  while (res > 0)
-  {
-    if (res == -1)
+    else if (waited == 0)
     {
-      throw ControllerError("Could not read output of `xdg-mime`");
+      usleep(1000);
     }
-    
-    buf[count++] = *c;
-    if (count == x * 5000)
+  }
+
+  script.ok = !failed && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void ExecScriptController::respond(Script const& script, Response& res) const
+{
+  if (!script.ok)
+  {
+    Controller::send_error_response(res, HttpStatus::InternalServerError, script.path + " failed\n");
+    return;
+  }
+
+  // scripts write a whole response, whose status line is replaced by one in the request's version
+  std::string const& output = script.output;
+  size_t line_end = output.find("\r\n");
+  HttpStatus const* status = nullptr;
+  if (line_end != std::string::npos && output.compare(0, 5, "HTTP/") == 0)
+  {
+    size_t code = output.find(' ');
+    if (code < line_end)
     {
-      x++;
-      buf = (char *) realloc(buf, x * 5000);
+      status = HttpStatus::find(atoi(output.c_str() + code + 1));
     }
-    
-    res = read(child_stdout[0], c, 1);
   }
-  buf[4999] = '\0';
-  
-  if (close(child_stdout[0]) == -1)
+  if (status == nullptr)
+  {
+    Controller::send_error_response(res, HttpStatus::InternalServerError, script.path + " did not write a valid response\n");
+    return;
+  }
+
+  res.set_status(*status);
+  res.send(output.data() + line_end + 2, output.size() - line_end - 2, true);
+}
+
+void ExecScriptController::set_environment(Request const& req, std::vector<std::string>& env) const
+{
+  // the request's own variables win over any the server was started with
+  for (char** var = environ; *var != nullptr; var++)
+  {
+    if (strncmp(*var, "HTTP:", 5) != 0)
     {
-      throw ControllerError("Could not close pipe output");
+      env.push_back(*var);
     }
+  }
 
-  // remove the trailing newline before returning
-  std::string content_type(buf);
-  content_type = content_type.substr(0, content_type.size() - 1);
+  std::string http = "HTTP:";
+  env.push_back(http + "METHOD=" + std::string(req.get_method()));
+  env.push_back(http + "PATH=" + std::string(req.get_path()));
 
-  d_printf("Got content type of %s for %s", content_type.c_str(), filename.c_str());
+  set_var(req.get_headers(), http + "HEADER:", env);
+  set_var(req.get_query(), http + "QUERY:", env);
+  set_var(req.get_body(), http + "BODY:", env);
 
-  return content_type;
+  // uploaded files are already on disk, scripts get where
+  for (Request::Upload const& upload : req.get_uploads())
+  {
+    env.push_back(http + "FILE:" + upload.field + "=" + upload.path);
+  }
+}
+
+void ExecScriptController::set_var(Request::Table const& mapping, std::string key, std::vector<std::string>& env) const
+{
+  for (auto const& element : mapping)
+  {
+    env.push_back(key + std::string(element.first) + "=" + std::string(element.second));
+  }
+}
+
+void ExecScriptController::set_var(HeaderTable const& headers, std::string key, std::vector<std::string>& env) const
+{
+  headers.for_each([&](std::string_view name, std::string_view value)
+  {
+    env.push_back(key + std::string(name) + "=" + std::string(value));
+  });
 }
@@ -1,138 +1,180 @@
 #include <string>
-#include <fstream>
 #include <unistd.h>
 #include <cstring>
+#include <fcntl.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <sys/stat.h>
 #include <climits>
 #include <cstdlib>
+#include <cerrno>
 
 #include "Config.hpp"
 #include "Utils.hpp"
 #include "controller/Controller.hpp"
 #include "controller/SendFileController.hpp"
 #include "http/HttpStatus.hpp"
+#include "http/MimeTypes.hpp"
+#include "http/Validators.hpp"
 #include "error/ControllerError.hpp"
 #include "error/TodoError.hpp"
 
 SendFileController::SendFileController(Config const& config) :
-    Controller(config)
+    Controller(config),
+    m_watcher(new DirWatcher(config.static_dir)),
+    m_open_files(new OpenFileCache(*m_watcher, config.mode == Config::SM_FORK ? 0 : config.open_files,
+                                   config.open_file_ttl * 1000L)),
+    m_cache(new FileCache(*m_watcher, config.mode == Config::SM_FORK ? 0 : config.file_cache)),
+    m_mappings(new MappedFiles(config.mode == Config::SM_FORK ? 0 : config.mmap_files))
 {
 
 }
 
 void SendFileController::run(Request const& req, Response& res) const
 {
-  std::string resolved_path;
-  if (Controller::resolve_requested_path(req.get_path(), m_config.static_dir, resolved_path) == false)
-  {
-    Controller::send_error_response(res, HttpStatus::NotFound, req.get_path() + " could not be found\n");
-  }
-
-  // open the file to get the size and contents of the file and close it. Send the response
-  std::fstream fs;
-  fs.open(resolved_path, std::fstream::in | std::fstream::binary);
-
-  if (fs.is_open())
-  {
-    int size      = get_content_length(fs);
-    char *content = (char *) malloc(size + 1);
-    fs.clear();
-    fs.seekp(fs.beg);
-    fs.read(content, size);
-    content[size] = '\0';
-    fs.close();
-    
-    res.set_status(HttpStatus::Ok);
-    res.set_header("Content-Type", get_content_type(resolved_path));
-    res.set_header("Content-Length", std::to_string(size));
-    res.send(content, size);
-
-    free(content);
-  }
-  else
-  {
-    Controller::send_error_response(res, HttpStatus::NotFound, req.get_path() + " could not be found\n");
-  }
-  //throw TodoError("4", "You need to implement SendFileController");
-}
-
-int SendFileController::get_content_length(std::fstream& fs) const
-{
-  int length = 0;
-  while (fs.get() != EOF)
-  {
-    length++;
-  }
-
-  return length;
-  //throw TodoError("4", "You need to implement getting the length of a file");
-}
-
-// unfortunately, the only semi-reliable way to get MIME types of files is
-// using shell commands xdg-mime and file
-// as such, we subshell out to `xdg-mime query filetype <filename>`
-std::string SendFileController::get_content_type(std::string const& filename) const
-{
-    int child_stdout[2];
-    if (pipe(child_stdout) == -1)
+    std::shared_ptr<OpenFileCache::File const> file = open_file(req.get_path());
+    if (file == nullptr)
     {
-        throw ControllerError("Could not create pipe to communicate with `xdg-mime`");
+        Controller::send_error_response(res, HttpStatus::Forbidden, std::string(req.get_path()) + " may not be accessed\n");
+        return;
     }
-
-    d_printf("Getting content type. child_stdout = {%d, %d}", child_stdout[0], child_stdout[1]);
-
-    pid_t child = fork();
-    if (child == -1)
+    if (!file->exists())
     {
-        throw ControllerError("Could not create child process to find MIME type");
+        Controller::send_error_response(res, HttpStatus::NotFound, std::string(req.get_path()) + " could not be found\n");
+        return;
     }
-    if (child == 0)
+
+    std::shared_ptr<FileCache::Entry const> cached = m_cache->find(file->resolved);
+    std::shared_ptr<MappedFiles::Mapping const> mapped;
+    std::string_view type;
+    if (cached == nullptr)
     {
-        if (dup2(child_stdout[1], STDOUT_FILENO) == -1)
+        // small files go into the cache, larger ones get mapped, sendfile() if neither works
+        type = MimeTypes::resolve(file->resolved, file->fd);
+        mapped = m_mappings->find(file->resolved);
+        if (mapped == nullptr)
         {
-            exit(1);
+            cached = m_cache->load(file->resolved, file->fd, file->st, type);
         }
+        if (mapped == nullptr && cached == nullptr)
+        {
+            mapped = m_mappings->map(file->resolved, file->fd, file->st);
+        }
+    }
 
-        execlp("xdg-mime", "xdg-mime", "query", "filetype", filename.c_str(), 0);
-        exit(1);
+    // cached files have a strong ETag from their contents, the others a weak one from their stat
+    if (cached != nullptr)
+    {
+        if (!answer_conditional(req, res, cached->etag, cached->last_modified, cached->mtime))
+        {
+            send_cached(res, *cached);
+        }
+        return;
+    }
+    if (answer_conditional(req, res, file->etag, file->last_modified, file->st.st_mtime))
+    {
+        return;
     }
 
-    if (close(child_stdout[1]) == -1)
+    res.set_header("ETag", file->etag);
+    res.set_header("Last-Modified", file->last_modified);
+    if (mapped != nullptr)
     {
-        throw ControllerError("Could not close pipe input");
+        send_mapped(res, std::move(mapped), type);
+        return;
     }
 
-    int status;
-    if (waitpid(child, &status, 0) == -1)
+    res.set_status(HttpStatus::Ok);
+    res.set_header("Content-Type", type);
+    res.set_header("Content-Length", std::to_string(file->st.st_size));
+    res.send_file(file->fd, file->st.st_size);
+}
+
+bool SendFileController::answer_conditional(Request const& req, Response& res, std::string_view etag,
+                                            std::string_view last_modified, time_t mtime) const
+{
+    switch (Validators::evaluate(req.get_headers(), req.get_method() != "POST", etag, mtime))
     {
-        throw ControllerError("Error while waiting for finding MIME type to finish");
+    case Validators::VALIDATORS_NOT_MODIFIED:
+        // the validators go out again so the client can update what it has stored
+        res.set_status(HttpStatus::NotModified);
+        res.set_header("ETag", etag);
+        res.set_header("Last-Modified", last_modified);
+        res.send_empty();
+        return true;
+    case Validators::VALIDATORS_PRECONDITION_FAILED:
+        Controller::send_error_response(res, HttpStatus::PreconditionFailed,
+                                        std::string(req.get_path()) + " does not meet the preconditions of the request\n");
+        return true;
+    default:
+        return false;
     }
+}
 
-    if ((WIFEXITED(status) && WEXITSTATUS(status) != 0) || WIFSIGNALED(status))
+std::shared_ptr<OpenFileCache::File const> SendFileController::open_file(std::string_view requested) const
+{
+    std::shared_ptr<OpenFileCache::File const> file = m_open_files->find(requested);
+    if (file != nullptr)
     {
-        throw ControllerError("`xdg-mime` exited with errors");
+        return file;
     }
 
-    size_t const max_content_length = 50;
-    char buf[max_content_length];
-    memset(buf, 0, max_content_length);
+    // taken before anything is looked at, so a change in the meantime keeps the result out of the cache
+    uint64_t generation = m_watcher->generation();
 
-    if (read(child_stdout[0], buf, max_content_length - 1) == -1)
+    std::string resolved;
+    struct stat st{};
+    int fd = -1;
+    if (Controller::resolve_requested_path(requested, m_config.static_dir, resolved))
     {
-        throw ControllerError("Could not read output of `xdg-mime`");
+        fd = open(resolved.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1 && errno != ENOENT && errno != ENOTDIR && errno != EACCES)
+        {
+            // out of descriptors or the like, which is no reason to say (and remember)
+            // that there is nothing there
+            throw ControllerError("Could not open " + resolved + ": " + strerror(errno));
+        }
     }
 
-    if (close(child_stdout[0]) == -1)
+    // a file or directory the server may not read is there all the same, and permissions can change
+    if (fd == -1 && errno == EACCES)
+    {
+        return nullptr;
+    }
+    if (fd != -1 && fstat(fd, &st) == -1)
+    {
+        int error = errno;
+        close(fd);
+        throw ControllerError("Could not stat " + resolved + ": " + strerror(error));
+    }
+    if (fd != -1 && !S_ISREG(st.st_mode))
     {
-        throw ControllerError("Could not close pipe output");
+        close(fd);
+        fd = -1;
     }
 
-    // remove the trailing newline before returning
-    std::string content_type(buf);
-    content_type = content_type.substr(0, content_type.size() - 1);
+    file = std::make_shared<OpenFileCache::File const>(std::move(resolved), fd, st);
+    return m_open_files->insert(requested, std::move(file), generation);
+}
+
+void SendFileController::send_cached(Response& res, FileCache::Entry const& entry) const
+{
+    res.set_status(HttpStatus::Ok);
+    res.send_prepared(entry.headers, entry.data.data(), entry.data.size());
+}
 
-    d_printf("Got content type of %s for %s", content_type.c_str(), filename.c_str());
+void SendFileController::send_mapped(Response& res, std::shared_ptr<MappedFiles::Mapping const> mapping,
+                                     std::string_view type) const
+{
+    res.set_status(HttpStatus::Ok);
+    res.set_header("Content-Type", type);
+    res.set_header("Content-Length", std::to_string(mapping->size));
 
-    return content_type;
+    char const* data = mapping->data;
+    size_t size = mapping->size;
+    res.send_shared(std::move(mapping), data, size);
+}
+
+FileCache const& SendFileController::cache() const noexcept
+{
+    return *m_cache;
 }
@@ -0,0 +1,202 @@
+#include <cstring>
+#include <algorithm>
+
+#include "http/BodyDecoder.hpp"
+#include "http/HttpStatus.hpp"
+
+BodyDecoder::BodyDecoder()
+{
+    reset();
+}
+
+void BodyDecoder::reset() noexcept
+{
+    m_state = STATE_IDLE;
+    m_remaining = 0;
+    m_max_size = 0;
+    m_decoded = 0;
+    m_error = nullptr;
+    m_error_text = "";
+}
+
+void BodyDecoder::expect_none() noexcept
+{
+    reset();
+    m_state = STATE_DONE;
+}
+
+void BodyDecoder::expect_length(size_t length) noexcept
+{
+    reset();
+    m_remaining = length;
+    m_state = length == 0 ? STATE_DONE : STATE_LENGTH;
+}
+
+void BodyDecoder::expect_chunked(size_t max_size) noexcept
+{
+    reset();
+    m_max_size = max_size;
+    m_state = STATE_CHUNK_SIZE;
+}
+
+void BodyDecoder::fail(HttpStatus const& status, char const* text) noexcept
+{
+    fail_with(status, text);
+}
+
+BodyDecoder::Result BodyDecoder::decode(char const* data, size_t size, size_t want, size_t& used,
+                                        std::string_view& piece) noexcept
+{
+    used = 0;
+    piece = std::string_view();
+
+    while (true)
+    {
+        switch (m_state)
+        {
+        case STATE_IDLE:
+        case STATE_DONE:
+            return BODY_DONE;
+        case STATE_ERROR:
+            return BODY_ERROR;
+        case STATE_LENGTH:
+        case STATE_CHUNK_DATA:
+        {
+            if (used == size || want == 0)
+            {
+                return BODY_INCOMPLETE;
+            }
+
+            size_t length = std::min({ m_remaining, size - used, want });
+            piece = std::string_view(data + used, length);
+            used += length;
+            m_remaining -= length;
+            m_decoded += length;
+
+            if (m_remaining == 0)
+            {
+                m_state = m_state == STATE_LENGTH ? STATE_DONE : STATE_CHUNK_END;
+            }
+            return m_state == STATE_DONE ? BODY_DONE : BODY_INCOMPLETE;
+        }
+        default:
+        {
+            // everything else is a line of its own
+            char const* newline = (char const*) memchr(data + used, '\n', size - used);
+            if (newline == nullptr)
+            {
+                if (size - used > m_max_line)
+                {
+                    return fail_with(HttpStatus::BadRequest, "Chunk framing line too long\n");
+                }
+                return BODY_INCOMPLETE;
+            }
+
+            size_t end = newline - data;
+            if (end == used || data[end - 1] != '\r' || end - used > m_max_line)
+            {
+                return fail_with(HttpStatus::BadRequest, "Malformed chunk framing\n");
+            }
+
+            std::string_view line(data + used, end - 1 - used);
+            used = end + 1;
+
+            Result result = decode_line(line);
+            if (result != BODY_INCOMPLETE)
+            {
+                return result;
+            }
+        }
+        }
+    }
+}
+
+BodyDecoder::Result BodyDecoder::decode_line(std::string_view line) noexcept
+{
+    switch (m_state)
+    {
+    case STATE_CHUNK_SIZE:
+    {
+        // the size in hex, optionally followed by extensions after a ';' that are ignored
+        size_t size = 0;
+        size_t i = 0;
+        for (; i < line.length(); i++)
+        {
+            char c = line[i];
+            int digit = c >= '0' && c <= '9' ? c - '0'
+                      : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                      : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0)
+            {
+                break;
+            }
+            if (size > (m_max_size >> 4))
+            {
+                return fail_with(HttpStatus::Forbidden, "Request body too large\n");
+            }
+            size = size << 4 | digit;
+        }
+
+        if (i == 0 || (i < line.length() && line[i] != ';' && line[i] != ' ' && line[i] != '\t'))
+        {
+            return fail_with(HttpStatus::BadRequest, "Malformed chunk size\n");
+        }
+        if (size > m_max_size - m_decoded)
+        {
+            return fail_with(HttpStatus::Forbidden, "Request body too large\n");
+        }
+
+        m_remaining = size;
+        m_state = size == 0 ? STATE_TRAILERS : STATE_CHUNK_DATA;
+        return BODY_INCOMPLETE;
+    }
+    case STATE_CHUNK_END:
+        if (!line.empty())
+        {
+            return fail_with(HttpStatus::BadRequest, "Chunk longer than its size\n");
+        }
+        m_state = STATE_CHUNK_SIZE;
+        return BODY_INCOMPLETE;
+    default:
+        // trailer fields are not used for anything, the blank line after them ends the body
+        if (line.empty())
+        {
+            m_state = STATE_DONE;
+            return BODY_DONE;
+        }
+        return BODY_INCOMPLETE;
+    }
+}
+
+bool BodyDecoder::started() const noexcept
+{
+    return m_state != STATE_IDLE;
+}
+
+bool BodyDecoder::done() const noexcept
+{
+    return m_state == STATE_DONE || m_state == STATE_IDLE;
+}
+
+bool BodyDecoder::failed() const noexcept
+{
+    return m_state == STATE_ERROR;
+}
+
+BodyDecoder::Result BodyDecoder::fail_with(HttpStatus const& status, char const* text) noexcept
+{
+    m_state = STATE_ERROR;
+    m_error = &status;
+    m_error_text = text;
+    return BODY_ERROR;
+}
+
+HttpStatus const& BodyDecoder::error() const noexcept
+{
+    return m_error != nullptr ? *m_error : HttpStatus::BadRequest;
+}
+
+char const* BodyDecoder::error_text() const noexcept
+{
+    return m_error_text;
+}
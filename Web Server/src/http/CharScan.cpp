@@ -0,0 +1,162 @@
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHARSCAN_X86 1
+#endif
+
+#include "http/CharScan.hpp"
+
+static constexpr bool is_token(unsigned char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')
+        || std::string_view("!#$%&'*+-.^_`|~").find(c) != std::string_view::npos;
+}
+
+static constexpr bool is_field(unsigned char c)
+{
+    return (c >= 0x20 && c < 0x7f) || c == '\t';
+}
+
+static constexpr bool is_target(unsigned char c)
+{
+    return c > 0x20 && c < 0x7f;
+}
+
+static constexpr bool is_query_plain(unsigned char c)
+{
+    return c < 0x80 && std::string_view("&=%+").find(c) == std::string_view::npos;
+}
+
+static constexpr CharScan::Set make_set(bool (*contains)(unsigned char), bool high)
+{
+    CharScan::Set set{ {}, high };
+    for (unsigned c = 0; c < 0x80; c++)
+    {
+        if (contains(c))
+        {
+            set.low[c & 0x0f] |= 1 << (c >> 4);
+        }
+    }
+    return set;
+}
+
+CharScan::Set const CharScan::token = make_set(is_token, false);
+CharScan::Set const CharScan::field = make_set(is_field, true);
+CharScan::Set const CharScan::target = make_set(is_target, true);
+CharScan::Set const CharScan::query_plain = make_set(is_query_plain, true);
+
+static inline bool contains(CharScan::Set const& set, unsigned char c) noexcept
+{
+    return c < 0x80 ? (set.low[c & 0x0f] >> (c >> 4)) & 1 : set.high;
+}
+
+static size_t span_scalar(char const* data, size_t size, CharScan::Set const& set) noexcept
+{
+    size_t i = 0;
+    while (i < size && contains(set, data[i]))
+    {
+        i++;
+    }
+    return i;
+}
+
+#ifdef CHARSCAN_X86
+/**
+ * Both vector versions classify a byte x by looking up row = set.low[x & 0xf] and
+ * column = 1 << (x >> 4), which is 0 for bytes from 0x80 up. x is in the set if
+ * row & column is not 0, or if it is one of those high bytes and set.high is true.
+**/
+__attribute__((target("sse4.2")))
+static size_t span_sse42(char const* data, size_t size, CharScan::Set const& set) noexcept
+{
+    __m128i const rows = _mm_loadu_si128((__m128i const*) set.low);
+    __m128i const columns = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i const nibble = _mm_set1_epi8(0x0f);
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const high = set.high ? _mm_set1_epi8(-1) : zero;
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((__m128i const*) (data + i));
+        __m128i row = _mm_shuffle_epi8(rows, _mm_and_si128(x, nibble));
+        __m128i column = _mm_shuffle_epi8(columns, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+        __m128i outside = _mm_cmpeq_epi8(_mm_and_si128(row, column), zero);
+        outside = _mm_andnot_si128(_mm_and_si128(_mm_cmplt_epi8(x, zero), high), outside);
+
+        int mask = _mm_movemask_epi8(outside);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + span_scalar(data + i, size - i, set);
+}
+
+__attribute__((target("avx2")))
+static size_t span_avx2(char const* data, size_t size, CharScan::Set const& set) noexcept
+{
+    // shuffles only look within their own 128-bit lane, so both lanes get the tables
+    __m256i const rows = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*) set.low));
+    __m256i const columns = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128, 0, 0, 0, 0, 0, 0, 0, 0));
+    __m256i const nibble = _mm256_set1_epi8(0x0f);
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const high = set.high ? _mm256_set1_epi8(-1) : zero;
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((__m256i const*) (data + i));
+        __m256i row = _mm256_shuffle_epi8(rows, _mm256_and_si256(x, nibble));
+        __m256i column = _mm256_shuffle_epi8(columns, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+        __m256i outside = _mm256_cmpeq_epi8(_mm256_and_si256(row, column), zero);
+        outside = _mm256_andnot_si256(_mm256_and_si256(_mm256_cmpgt_epi8(zero, x), high), outside);
+
+        unsigned mask = _mm256_movemask_epi8(outside);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    // the last few bytes still get 16 at a time
+    return i + span_sse42(data + i, size - i, set);
+}
+#endif
+
+typedef size_t (*SpanFunction)(char const*, size_t, CharScan::Set const&);
+
+static SpanFunction choose_span(char const*& name) noexcept
+{
+#ifdef CHARSCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        name = "avx2";
+        return span_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        name = "sse4.2";
+        return span_sse42;
+    }
+#endif
+    name = "scalar";
+    return span_scalar;
+}
+
+static char const* span_name;
+static SpanFunction const span_function = choose_span(span_name);
+
+size_t CharScan::span(char const* data, size_t size, Set const& set) noexcept
+{
+    return span_function(data, size, set);
+}
+
+char const* CharScan::implementation() noexcept
+{
+    return span_name;
+}
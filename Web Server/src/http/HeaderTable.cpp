@@ -0,0 +1,148 @@
+#include <strings.h>
+
+#include "http/HeaderTable.hpp"
+
+static constexpr std::string_view known_names[HeaderTable::known] = {
+    "Host",
+    "Connection",
+    "Content-Length",
+    "Content-Type",
+    "Transfer-Encoding",
+    "Accept",
+    "Accept-Encoding",
+    "If-None-Match",
+    "If-Modified-Since",
+    "If-Match",
+    "If-Unmodified-Since",
+    "Range",
+    "User-Agent",
+    "Expect",
+    "Cookie",
+    "Authorization",
+};
+
+/**
+ * The hash only looks at the length and the first and last letters, folded to lower case
+ * (| 0x20 leaves the other characters of a token alone, so it can be applied blindly).
+ * For the names above it never collides, which make_buckets() checks at compile time.
+ * Adding a header may mean picking new multipliers or more buckets.
+**/
+static size_t const bucket_count = 32;
+
+static constexpr size_t bucket_of(std::string_view name)
+{
+    return (name.length() * 3 + (name.front() | 0x20) * 7 + (name.back() | 0x20)) % bucket_count;
+}
+
+struct Buckets
+{
+    int8_t id[bucket_count];
+    bool perfect;
+};
+
+static constexpr Buckets make_buckets()
+{
+    Buckets buckets{ {}, true };
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        buckets.id[i] = -1;
+    }
+    for (size_t id = 0; id < HeaderTable::known; id++)
+    {
+        size_t bucket = bucket_of(known_names[id]);
+        buckets.perfect = buckets.perfect && buckets.id[bucket] == -1;
+        buckets.id[bucket] = id;
+    }
+    return buckets;
+}
+
+static constexpr Buckets buckets = make_buckets();
+static_assert(buckets.perfect, "two known headers hash to the same bucket");
+
+HeaderTable::Id HeaderTable::lookup(std::string_view name) noexcept
+{
+    if (name.empty())
+    {
+        return OTHER;
+    }
+
+    int id = buckets.id[bucket_of(name)];
+    if (id < 0 || known_names[id].length() != name.length()
+        || strncasecmp(known_names[id].data(), name.data(), name.length()) != 0)
+    {
+        return OTHER;
+    }
+    return (Id) id;
+}
+
+std::string_view HeaderTable::name(Id id) noexcept
+{
+    return id < known ? known_names[id] : std::string_view();
+}
+
+HeaderTable::HeaderTable(std::pmr::memory_resource* arena) :
+    m_entries(arena)
+{
+    m_entries.reserve(16);
+    for (size_t id = 0; id < known; id++)
+    {
+        m_slots[id] = -1;
+    }
+}
+
+void HeaderTable::set(std::string_view name, std::string_view value)
+{
+    set(lookup(name), name, value);
+}
+
+void HeaderTable::set(Id id, std::string_view name, std::string_view value)
+{
+    int at = id == OTHER ? find_other(name) : m_slots[id];
+    if (at >= 0)
+    {
+        m_entries[at].value = value;
+        return;
+    }
+
+    if (id != OTHER)
+    {
+        m_slots[id] = m_entries.size();
+    }
+    m_entries.push_back(Entry{ id, name, value });
+}
+
+std::string_view const* HeaderTable::find(Id id) const noexcept
+{
+    return id < known && m_slots[id] >= 0 ? &m_entries[m_slots[id]].value : nullptr;
+}
+
+std::string_view const* HeaderTable::find(std::string_view name) const noexcept
+{
+    Id id = lookup(name);
+    if (id != OTHER)
+    {
+        return find(id);
+    }
+
+    int at = find_other(name);
+    return at < 0 ? nullptr : &m_entries[at].value;
+}
+
+size_t HeaderTable::size() const noexcept
+{
+    return m_entries.size();
+}
+
+int HeaderTable::find_other(std::string_view name) const noexcept
+{
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        Entry const& entry = m_entries[i];
+        if (entry.id == OTHER && entry.name.length() == name.length()
+            && strncasecmp(entry.name.data(), name.data(), name.length()) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,243 @@
+#include <cstring>
+
+#include "http/HttpParser.hpp"
+#include "http/CharScan.hpp"
+#include "http/HttpStatus.hpp"
+
+HttpParser::HttpParser(size_t max_head) :
+    m_max_head(max_head)
+{
+    m_headers.reserve(16);
+    reset();
+}
+
+void HttpParser::reset() noexcept
+{
+    m_state = STATE_REQUEST_LINE;
+    m_data = nullptr;
+    m_line = 0;
+    m_scanned = 0;
+    m_method = m_path = m_query = m_version = Span{ 0, 0 };
+    m_headers.clear();
+    for (size_t id = 0; id < HeaderTable::known; id++)
+    {
+        m_known[id] = -1;
+    }
+    m_head_length = 0;
+    m_error = nullptr;
+    m_error_text = "";
+}
+
+HttpParser::Result HttpParser::parse(char const* data, size_t size) noexcept
+{
+    m_data = data;
+
+    while (m_state == STATE_REQUEST_LINE || m_state == STATE_HEADERS)
+    {
+        // only look at what is new since the last call
+        char const* newline = (char const*) memchr(data + m_scanned, '\n', size - m_scanned);
+        if (newline == nullptr)
+        {
+            m_scanned = size;
+            if (size >= m_max_head)
+            {
+                return fail(HttpStatus::BadRequest, "Request head too large\n");
+            }
+            return PARSE_INCOMPLETE;
+        }
+
+        size_t end = newline - data + 1;
+        if (end > m_max_head)
+        {
+            return fail(HttpStatus::BadRequest, "Request head too large\n");
+        }
+        if (end - m_line < 2 || data[end - 2] != '\r')
+        {
+            return fail(HttpStatus::BadRequest, "Line not terminated by CRLF\n");
+        }
+
+        // the line without its \r\n
+        size_t begin = m_line;
+        m_line = m_scanned = end;
+
+        Result result = m_state == STATE_REQUEST_LINE ? parse_request_line(begin, end - 2)
+                                                      : parse_header_line(begin, end - 2);
+        if (result != PARSE_INCOMPLETE)
+        {
+            return result;
+        }
+    }
+
+    return m_state == STATE_DONE ? PARSE_DONE : PARSE_ERROR;
+}
+
+HttpParser::Result HttpParser::parse_request_line(size_t begin, size_t end) noexcept
+{
+    std::string_view line(m_data + begin, end - begin);
+
+    size_t method_end = CharScan::span(line.data(), line.length(), CharScan::token);
+    std::string_view method = line.substr(0, method_end);
+    if (method != "GET" && method != "HEAD" && method != "POST")
+    {
+        return fail(HttpStatus::MethodNotAllowed, "Method not allowed\n");
+    }
+
+    size_t target = method_end + 1;
+    if (target >= line.length() || line[method_end] != ' ' || line[target] != '/')
+    {
+        return fail(HttpStatus::BadRequest, "Malformed request-line\n");
+    }
+
+    // the target runs up to the next space and may not contain control characters
+    size_t target_end = target + CharScan::span(line.data() + target, line.length() - target, CharScan::target);
+    if (target_end == line.length() || line[target_end] != ' ')
+    {
+        return fail(HttpStatus::BadRequest, "Malformed request-line\n");
+    }
+
+    std::string_view version = line.substr(target_end + 1);
+    if (version != "HTTP/1.0" && version != "HTTP/1.1")
+    {
+        return fail(HttpStatus::HttpVersionNotSupported, "Version not supported\n");
+    }
+
+    // anything after a '?' in the target is the query string
+    size_t question = line.find('?', target);
+    size_t path_end = question < target_end ? question : target_end;
+
+    m_method = Span{ (uint32_t) begin, (uint32_t) method_end };
+    m_path = Span{ (uint32_t) (begin + target), (uint32_t) (path_end - target) };
+    if (path_end < target_end)
+    {
+        m_query = Span{ (uint32_t) (begin + path_end + 1), (uint32_t) (target_end - path_end - 1) };
+    }
+    m_version = Span{ (uint32_t) (begin + target_end + 1), (uint32_t) version.length() };
+
+    m_state = STATE_HEADERS;
+    return PARSE_INCOMPLETE;
+}
+
+HttpParser::Result HttpParser::parse_header_line(size_t begin, size_t end) noexcept
+{
+    // a blank line ends the head
+    if (begin == end)
+    {
+        m_head_length = end + 2;
+        m_state = STATE_DONE;
+        return PARSE_DONE;
+    }
+
+    std::string_view line(m_data + begin, end - begin);
+
+    // the name is a token that has to end at the colon
+    size_t colon = CharScan::span(line.data(), line.length(), CharScan::token);
+    if (colon == 0 || colon == line.length() || line[colon] != ':')
+    {
+        return fail(HttpStatus::BadRequest, "Malformed header\n");
+    }
+
+    if (CharScan::span(line.data() + colon + 1, line.length() - colon - 1, CharScan::field) != line.length() - colon - 1)
+    {
+        return fail(HttpStatus::BadRequest, "Invalid character in header\n");
+    }
+
+    if (m_headers.size() == m_max_headers)
+    {
+        return fail(HttpStatus::BadRequest, "Too many headers\n");
+    }
+
+    // the value runs from after the colon to the end of the line, minus surrounding whitespace
+    size_t value = line.find_first_not_of(" \t", colon + 1);
+    size_t value_end = line.find_last_not_of(" \t");
+    Span value_span{ (uint32_t) end, 0 };
+    if (value != std::string_view::npos)
+    {
+        value_span = Span{ (uint32_t) (begin + value), (uint32_t) (value_end - value + 1) };
+    }
+
+    HeaderTable::Id id = HeaderTable::lookup(line.substr(0, colon));
+    if (id != HeaderTable::OTHER)
+    {
+        m_known[id] = m_headers.size();
+    }
+    m_headers.push_back(Header{ Span{ (uint32_t) begin, (uint32_t) colon }, value_span, id });
+    return PARSE_INCOMPLETE;
+}
+
+HttpParser::Result HttpParser::fail(HttpStatus const& status, char const* text) noexcept
+{
+    m_state = STATE_ERROR;
+    m_error = &status;
+    m_error_text = text;
+    return PARSE_ERROR;
+}
+
+std::string_view HttpParser::view(Span span) const noexcept
+{
+    return std::string_view(m_data + span.begin, span.length);
+}
+
+std::string_view HttpParser::method() const noexcept
+{
+    return view(m_method);
+}
+
+std::string_view HttpParser::path() const noexcept
+{
+    return view(m_path);
+}
+
+std::string_view HttpParser::query() const noexcept
+{
+    return view(m_query);
+}
+
+std::string_view HttpParser::version() const noexcept
+{
+    return view(m_version);
+}
+
+size_t HttpParser::header_count() const noexcept
+{
+    return m_headers.size();
+}
+
+HeaderTable::Id HttpParser::header_id(size_t i) const noexcept
+{
+    return m_headers[i].id;
+}
+
+std::string_view HttpParser::header_name(size_t i) const noexcept
+{
+    return view(m_headers[i].name);
+}
+
+std::string_view HttpParser::header_value(size_t i) const noexcept
+{
+    return view(m_headers[i].value);
+}
+
+bool HttpParser::find_header(HeaderTable::Id id, std::string_view& value) const noexcept
+{
+    if (id >= HeaderTable::known || m_known[id] < 0)
+    {
+        return false;
+    }
+    value = view(m_headers[m_known[id]].value);
+    return true;
+}
+
+size_t HttpParser::head_length() const noexcept
+{
+    return m_head_length;
+}
+
+HttpStatus const& HttpParser::error() const noexcept
+{
+    return m_error != nullptr ? *m_error : HttpStatus::BadRequest;
+}
+
+char const* HttpParser::error_text() const noexcept
+{
+    return m_error_text;
+}
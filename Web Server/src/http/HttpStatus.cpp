@@ -10,10 +10,29 @@ std::string HttpStatus::to_string() const noexcept
 }
 
 const HttpStatus HttpStatus::Ok(OK, "OK");
+const HttpStatus HttpStatus::NotModified(NOT_MODIFIED, "Not Modified");
 const HttpStatus HttpStatus::BadRequest(BAD_REQUEST, "Bad Request");
 const HttpStatus HttpStatus::Forbidden(FORBIDDEN, "Forbidden");
 const HttpStatus HttpStatus::NotFound(NOT_FOUND, "Not Found");
 const HttpStatus HttpStatus::MethodNotAllowed(METHOD_NOT_ALLOWED, "Method Not Allowed");
+const HttpStatus HttpStatus::PreconditionFailed(PRECONDITION_FAILED, "Precondition Failed");
 const HttpStatus HttpStatus::UnsupportedMediaType(UNSUPPORTED_MEDIA_TYPE, "Unsupported Media Type");
 const HttpStatus HttpStatus::InternalServerError(INTERNAL_SERVER_ERROR, "Internal Server Error");
 const HttpStatus HttpStatus::HttpVersionNotSupported(HTTP_VERSION_NOT_SUPPORTED, "HTTP Version Not Supported");
+
+HttpStatus const* HttpStatus::find(int code) noexcept
+{
+    static HttpStatus const* const statuses[] = {
+        &Ok, &NotModified, &BadRequest, &Forbidden, &NotFound, &MethodNotAllowed, &PreconditionFailed,
+        &UnsupportedMediaType, &InternalServerError, &HttpVersionNotSupported
+    };
+
+    for (HttpStatus const* status : statuses)
+    {
+        if (status->m_code == code)
+        {
+            return status;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,252 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <algorithm>
+
+#include "http/MimeTypes.hpp"
+#include "Utils.hpp"
+
+struct Extension
+{
+    std::string_view extension;
+    std::string_view type;
+};
+
+// sorted by extension, which is checked below
+static constexpr Extension extensions[] = {
+    { "7z", "application/x-7z-compressed" },
+    { "avif", "image/avif" },
+    { "bin", "application/octet-stream" },
+    { "bmp", "image/bmp" },
+    { "c", "text/x-csrc" },
+    { "cpp", "text/x-c++src" },
+    { "css", "text/css" },
+    { "csv", "text/csv" },
+    { "gif", "image/gif" },
+    { "gz", "application/gzip" },
+    { "h", "text/x-chdr" },
+    { "htm", "text/html" },
+    { "html", "text/html" },
+    { "ico", "image/vnd.microsoft.icon" },
+    { "jpeg", "image/jpeg" },
+    { "jpg", "image/jpeg" },
+    { "js", "application/javascript" },
+    { "json", "application/json" },
+    { "md", "text/markdown" },
+    { "mjs", "application/javascript" },
+    { "mp3", "audio/mpeg" },
+    { "mp4", "video/mp4" },
+    { "ogg", "audio/ogg" },
+    { "otf", "font/otf" },
+    { "pdf", "application/pdf" },
+    { "png", "image/png" },
+    { "py", "text/x-python" },
+    { "sh", "application/x-shellscript" },
+    { "svg", "image/svg+xml" },
+    { "tar", "application/x-tar" },
+    { "ttf", "font/ttf" },
+    { "txt", "text/plain" },
+    { "wasm", "application/wasm" },
+    { "wav", "audio/x-wav" },
+    { "webm", "video/webm" },
+    { "webp", "image/webp" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "xml", "application/xml" },
+    { "zip", "application/zip" },
+};
+
+static constexpr bool sorted()
+{
+    for (size_t i = 1; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+    {
+        if (!(extensions[i - 1].extension < extensions[i].extension))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(sorted(), "the extension table has to stay sorted for the binary search");
+
+// filled in by load() before any threads start, only read after that
+static std::unordered_map<std::string, std::string> loaded;
+
+// paths that have been resolved before, forgotten all at once when there are too many
+static size_t const max_remembered = 4096;
+static std::shared_mutex remembered_mutex;
+static std::unordered_map<std::string, std::string_view> remembered;
+
+bool MimeTypes::load(std::string const& path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string type;
+        std::string extension;
+        if (!(words >> type))
+        {
+            continue;
+        }
+        while (words >> extension)
+        {
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            // an extension listed twice keeps its first type
+            loaded.emplace(extension, type);
+        }
+    }
+
+    d_printf("Loaded %zu MIME types from %s", loaded.size(), path.c_str());
+    return true;
+}
+
+std::string_view MimeTypes::by_extension(std::string_view extension) noexcept
+{
+    char lower[16];
+    if (extension.empty() || extension.length() > sizeof(lower))
+    {
+        return std::string_view();
+    }
+    for (size_t i = 0; i < extension.length(); i++)
+    {
+        lower[i] = tolower((unsigned char) extension[i]);
+    }
+    extension = std::string_view(lower, extension.length());
+
+    if (!loaded.empty())
+    {
+        try
+        {
+            auto found = loaded.find(std::string(extension));
+            if (found != loaded.end())
+            {
+                return found->second;
+            }
+        }
+        catch (std::bad_alloc const&)
+        {
+            // the compiled in table will do
+        }
+    }
+
+    Extension const* end = extensions + sizeof(extensions) / sizeof(extensions[0]);
+    Extension const* found = std::lower_bound(extensions, end, extension,
+        [](Extension const& entry, std::string_view key) { return entry.extension < key; });
+    return found != end && found->extension == extension ? found->type : std::string_view();
+}
+
+static bool starts_with(std::string_view data, std::string_view prefix, bool ignore_case = false) noexcept
+{
+    if (data.length() < prefix.length())
+    {
+        return false;
+    }
+    return ignore_case ? strncasecmp(data.data(), prefix.data(), prefix.length()) == 0
+                       : data.compare(0, prefix.length(), prefix) == 0;
+}
+
+std::string_view MimeTypes::sniff(char const* data, size_t size) noexcept
+{
+    std::string_view bytes(data, size);
+
+    if (starts_with(bytes, "\x89PNG\r\n\x1a\n")) return "image/png";
+    if (starts_with(bytes, "\xff\xd8\xff")) return "image/jpeg";
+    if (starts_with(bytes, "GIF87a") || starts_with(bytes, "GIF89a")) return "image/gif";
+    if (size >= 12 && starts_with(bytes, "RIFF") && bytes.substr(8, 4) == "WEBP") return "image/webp";
+    if (starts_with(bytes, "%PDF-")) return "application/pdf";
+    if (starts_with(bytes, "PK\x03\x04")) return "application/zip";
+    if (starts_with(bytes, "\x1f\x8b")) return "application/gzip";
+    if (starts_with(bytes, "\x7f" "ELF")) return "application/x-executable";
+    if (starts_with(bytes, std::string_view("\0asm", 4))) return "application/wasm";
+
+    // from here on it has to be text, which has no control characters but whitespace
+    for (unsigned char c : bytes)
+    {
+        if (c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f')
+        {
+            return "application/octet-stream";
+        }
+    }
+
+    if (starts_with(bytes, "#!"))
+    {
+        std::string_view interpreter = bytes.substr(0, bytes.find('\n'));
+        if (interpreter.find("python") != std::string_view::npos) return "text/x-python";
+        if (interpreter.find("sh") != std::string_view::npos) return "application/x-shellscript";
+    }
+
+    size_t first = bytes.find_first_not_of(" \t\r\n");
+    std::string_view text = first == std::string_view::npos ? std::string_view() : bytes.substr(first);
+    if (starts_with(text, "<!doctype html", true) || starts_with(text, "<html", true)) return "text/html";
+    if (starts_with(text, "<svg")) return "image/svg+xml";
+    if (starts_with(text, "<?xml")) return "application/xml";
+
+    return "text/plain";
+}
+
+std::string_view MimeTypes::resolve(std::string const& path, int fd)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(remembered_mutex);
+        auto found = remembered.find(path);
+        if (found != remembered.end())
+        {
+            return found->second;
+        }
+    }
+
+    size_t slash = path.rfind('/');
+    size_t dot = path.rfind('.');
+    std::string_view type;
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+    {
+        type = by_extension(std::string_view(path).substr(dot + 1));
+    }
+
+    if (type.empty())
+    {
+        // the first 512 bytes are plenty for every signature and to tell text apart
+        char head[512];
+        int file = fd != -1 ? fd : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        ssize_t n = -1;
+        if (file != -1)
+        {
+            while ((n = pread(file, head, sizeof(head), 0)) == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (file != fd)
+            {
+                close(file);
+            }
+        }
+        if (n < 0)
+        {
+            // not remembered, it might be readable next time
+            return "application/octet-stream";
+        }
+        type = sniff(head, n);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(remembered_mutex);
+    if (remembered.size() >= max_remembered)
+    {
+        remembered.clear();
+    }
+    remembered.emplace(path, type);
+    return type;
+}
@@ -0,0 +1,273 @@
+#include <cstring>
+#include <strings.h>
+
+#include "http/MultipartParser.hpp"
+#include "http/HttpStatus.hpp"
+
+// splits "a; b=c; d" at the next ';' that is not inside quotes
+static std::string_view next_parameter(std::string_view& rest) noexcept
+{
+    bool quoted = false;
+    size_t i = 0;
+    for (; i < rest.length() && (quoted || rest[i] != ';'); i++)
+    {
+        if (rest[i] == '"')
+        {
+            quoted = !quoted;
+        }
+    }
+
+    std::string_view parameter = rest.substr(0, i);
+    rest = i < rest.length() ? rest.substr(i + 1) : std::string_view();
+
+    size_t first = parameter.find_first_not_of(" \t");
+    size_t last = parameter.find_last_not_of(" \t");
+    return first == std::string_view::npos ? std::string_view() : parameter.substr(first, last - first + 1);
+}
+
+// the value of a parameter called name, if parameter is one, without its quotes
+static bool parameter_value(std::string_view parameter, std::string_view name, std::string_view& value) noexcept
+{
+    size_t equals = parameter.find('=');
+    if (equals != name.length() || strncasecmp(parameter.data(), name.data(), name.length()) != 0)
+    {
+        return false;
+    }
+
+    value = parameter.substr(equals + 1);
+    if (value.length() >= 2 && value.front() == '"' && value.back() == '"')
+    {
+        value = value.substr(1, value.length() - 2);
+    }
+    return true;
+}
+
+bool MultipartParser::find_boundary(std::string_view content_type, std::string_view& boundary) noexcept
+{
+    next_parameter(content_type);
+    while (!content_type.empty())
+    {
+        // RFC 2046 allows 1 to 70 characters
+        if (parameter_value(next_parameter(content_type), "boundary", boundary))
+        {
+            return !boundary.empty() && boundary.length() <= 70;
+        }
+    }
+    return false;
+}
+
+MultipartParser::MultipartParser(std::string_view boundary) :
+    m_delimiter("\r\n--"),
+    m_state(STATE_PREAMBLE),
+    m_at_start(true),
+    m_header_bytes(0),
+    m_error_text("")
+{
+    m_delimiter.append(boundary);
+}
+
+MultipartParser::Result MultipartParser::parse(char const* data, size_t size, size_t& used, std::string_view& piece)
+{
+    used = 0;
+    piece = std::string_view();
+
+    while (true)
+    {
+        switch (m_state)
+        {
+        case STATE_PREAMBLE:
+        {
+            std::string_view rest(data + used, size - used);
+            std::string_view opening = std::string_view(m_delimiter).substr(2);
+
+            if (m_at_start)
+            {
+                if (rest.length() < opening.length() && opening.compare(0, rest.length(), rest) == 0)
+                {
+                    return MULTIPART_INCOMPLETE;
+                }
+                m_at_start = false;
+                if (rest.compare(0, opening.length(), opening) == 0)
+                {
+                    used += opening.length();
+                    m_state = STATE_DELIMITER;
+                    continue;
+                }
+            }
+
+            // anything before the first boundary is ignored
+            char const* found = (char const*) memmem(rest.data(), rest.length(), m_delimiter.data(), m_delimiter.length());
+            if (found == nullptr)
+            {
+                if (rest.length() >= m_delimiter.length())
+                {
+                    used = size - (m_delimiter.length() - 1);
+                }
+                return MULTIPART_INCOMPLETE;
+            }
+            used = found - data + m_delimiter.length();
+            m_state = STATE_DELIMITER;
+            continue;
+        }
+        case STATE_DELIMITER:
+        {
+            if (size - used < 2)
+            {
+                return MULTIPART_INCOMPLETE;
+            }
+            if (data[used] == '-' && data[used + 1] == '-')
+            {
+                used += 2;
+                m_state = STATE_EPILOGUE;
+                return MULTIPART_DONE;
+            }
+            if (data[used] != '\r' || data[used + 1] != '\n')
+            {
+                return fail("Malformed multipart boundary\n");
+            }
+
+            used += 2;
+            m_state = STATE_HEADERS;
+            m_header_bytes = 0;
+            m_name.clear();
+            m_filename.clear();
+            m_content_type.clear();
+            continue;
+        }
+        case STATE_HEADERS:
+        {
+            char const* newline = (char const*) memchr(data + used, '\n', size - used);
+            if (newline == nullptr)
+            {
+                if (size - used > m_max_line)
+                {
+                    return fail("Multipart header line too long\n");
+                }
+                return MULTIPART_INCOMPLETE;
+            }
+
+            size_t end = newline - data;
+            m_header_bytes += end + 1 - used;
+            if (end == used || data[end - 1] != '\r' || m_header_bytes > m_max_headers)
+            {
+                return fail("Malformed multipart headers\n");
+            }
+
+            std::string_view line(data + used, end - 1 - used);
+            used = end + 1;
+
+            // a blank line ends the headers
+            if (line.empty())
+            {
+                m_state = STATE_DATA;
+                return MULTIPART_PART;
+            }
+            if (parse_header(line) == MULTIPART_ERROR)
+            {
+                return MULTIPART_ERROR;
+            }
+            continue;
+        }
+        case STATE_DATA:
+        {
+            std::string_view rest(data + used, size - used);
+            char const* found = (char const*) memmem(rest.data(), rest.length(), m_delimiter.data(), m_delimiter.length());
+
+            if (found == rest.data())
+            {
+                used += m_delimiter.length();
+                m_state = STATE_DELIMITER;
+                return MULTIPART_END;
+            }
+
+            // without a boundary, the last bytes could still be the start of one
+            size_t length = found != nullptr ? found - rest.data()
+                          : rest.length() >= m_delimiter.length() ? rest.length() - (m_delimiter.length() - 1) : 0;
+            if (length == 0)
+            {
+                return MULTIPART_INCOMPLETE;
+            }
+
+            piece = rest.substr(0, length);
+            used += length;
+            return MULTIPART_DATA;
+        }
+        case STATE_EPILOGUE:
+            used = size;
+            return MULTIPART_DONE;
+        default:
+            return MULTIPART_ERROR;
+        }
+    }
+}
+
+MultipartParser::Result MultipartParser::parse_header(std::string_view line)
+{
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0)
+    {
+        return fail("Malformed multipart header\n");
+    }
+
+    std::string_view name = line.substr(0, colon);
+    std::string_view value = line.substr(colon + 1);
+    size_t first = value.find_first_not_of(" \t");
+    value = first == std::string_view::npos ? std::string_view() : value.substr(first);
+
+    if (name.length() == 12 && strncasecmp(name.data(), "Content-Type", 12) == 0)
+    {
+        m_content_type.assign(value);
+    }
+    else if (name.length() == 19 && strncasecmp(name.data(), "Content-Disposition", 19) == 0)
+    {
+        // form-data; name="field"; filename="file.txt"
+        next_parameter(value);
+        while (!value.empty())
+        {
+            std::string_view parameter = next_parameter(value);
+            std::string_view found;
+            if (parameter_value(parameter, "name", found))
+            {
+                m_name.assign(found);
+            }
+            else if (parameter_value(parameter, "filename", found))
+            {
+                m_filename.assign(found);
+            }
+        }
+    }
+
+    return MULTIPART_INCOMPLETE;
+}
+
+MultipartParser::Result MultipartParser::fail(char const* text) noexcept
+{
+    m_state = STATE_ERROR;
+    m_error_text = text;
+    return MULTIPART_ERROR;
+}
+
+std::string const& MultipartParser::name() const noexcept
+{
+    return m_name;
+}
+
+std::string const& MultipartParser::filename() const noexcept
+{
+    return m_filename;
+}
+
+std::string const& MultipartParser::content_type() const noexcept
+{
+    return m_content_type;
+}
+
+HttpStatus const& MultipartParser::error() const noexcept
+{
+    return HttpStatus::BadRequest;
+}
+
+char const* MultipartParser::error_text() const noexcept
+{
+    return m_error_text;
+}
@@ -0,0 +1,163 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "http/Validators.hpp"
+
+std::string Validators::http_date(time_t time)
+{
+    struct tm tm;
+    char buf[64];
+    gmtime_r(&time, &tm);
+    size_t length = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, length);
+}
+
+bool Validators::parse_http_date(std::string_view text, time_t& time) noexcept
+{
+    // the preferred format, then the obsolete RFC 850 and asctime() ones
+    static char const* const formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",
+        "%A, %d-%b-%y %H:%M:%S GMT",
+        "%a %b %e %H:%M:%S %Y"
+    };
+
+    char buf[64];
+    if (text.length() >= sizeof(buf))
+    {
+        return false;
+    }
+    memcpy(buf, text.data(), text.length());
+    buf[text.length()] = '\0';
+
+    for (char const* format : formats)
+    {
+        struct tm tm{};
+        char const* end = strptime(buf, format, &tm);
+        if (end != nullptr && *end == '\0')
+        {
+            time = timegm(&tm);
+            return time != -1;
+        }
+    }
+    return false;
+}
+
+std::string Validators::strong_etag(char const* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ (unsigned char) data[i]) * 0x100000001b3ULL;
+    }
+
+    char buf[24];
+    snprintf(buf, sizeof(buf), "\"%016llx\"", (unsigned long long) hash);
+    return buf;
+}
+
+std::string Validators::weak_etag(struct stat const& st)
+{
+    unsigned long long mtime = (unsigned long long) st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+
+    char buf[48];
+    snprintf(buf, sizeof(buf), "W/\"%llx-%llx\"", (unsigned long long) st.st_size, mtime);
+    return buf;
+}
+
+// the quoted part of an entity tag, and whether it had the W/ prefix
+static std::string_view opaque_tag(std::string_view etag, bool& weak) noexcept
+{
+    weak = etag.length() >= 2 && etag[0] == 'W' && etag[1] == '/';
+    return weak ? etag.substr(2) : etag;
+}
+
+bool Validators::matches(std::string_view list, std::string_view etag, bool weak) noexcept
+{
+    bool etag_weak;
+    std::string_view opaque = opaque_tag(etag, etag_weak);
+    if (!weak && etag_weak)
+    {
+        return false;
+    }
+
+    size_t i = 0;
+    while (true)
+    {
+        // entity tags are separated by commas and optional white space, empty elements are allowed
+        while (i < list.length() && (list[i] == ',' || list[i] == ' ' || list[i] == '\t'))
+        {
+            i++;
+        }
+        if (i == list.length())
+        {
+            return false;
+        }
+        if (list[i] == '*')
+        {
+            return true;
+        }
+
+        size_t begin = i;
+        if (list.compare(i, 2, "W/") == 0)
+        {
+            i += 2;
+        }
+        if (i == list.length() || list[i] != '"')
+        {
+            return false;
+        }
+        size_t close = list.find('"', i + 1);
+        if (close == std::string_view::npos)
+        {
+            return false;
+        }
+        i = close + 1;
+
+        bool tag_weak;
+        std::string_view tag = opaque_tag(list.substr(begin, i - begin), tag_weak);
+        if (tag == opaque && (weak || !tag_weak))
+        {
+            return true;
+        }
+    }
+}
+
+Validators::Result Validators::evaluate(HeaderTable const& headers, bool get_or_head, std::string_view etag,
+                                        time_t mtime) noexcept
+{
+    time_t since;
+
+    // If-Match wins over If-Unmodified-Since, and both are checked before the cache validators
+    std::string_view const* value = headers.find(HeaderTable::IF_MATCH);
+    if (value != nullptr)
+    {
+        if (!matches(*value, etag, false))
+        {
+            return VALIDATORS_PRECONDITION_FAILED;
+        }
+    }
+    else if ((value = headers.find(HeaderTable::IF_UNMODIFIED_SINCE)) != nullptr
+             && parse_http_date(*value, since) && mtime > since)
+    {
+        return VALIDATORS_PRECONDITION_FAILED;
+    }
+
+    // likewise If-None-Match over If-Modified-Since, which only means something for GET and HEAD
+    value = headers.find(HeaderTable::IF_NONE_MATCH);
+    if (value != nullptr)
+    {
+        if (matches(*value, etag, true))
+        {
+            return get_or_head ? VALIDATORS_NOT_MODIFIED : VALIDATORS_PRECONDITION_FAILED;
+        }
+    }
+    else if (get_or_head && (value = headers.find(HeaderTable::IF_MODIFIED_SINCE)) != nullptr
+             && parse_http_date(*value, since) && mtime <= since)
+    {
+        return VALIDATORS_NOT_MODIFIED;
+    }
+
+    return VALIDATORS_SEND;
+}
@@ -35,10 +35,22 @@ int main(int argc, char** argv)
         {
             server.run_fork();
         }
+        else if (config.mode == Config::SM_PREFORK)
+        {
+            server.run_prefork();
+        }
         else if (config.mode == Config::SM_POOLTHREAD)
         {
             server.run_thread_pool();
         }
+        else if (config.mode == Config::SM_EVENTLOOP)
+        {
+            server.run_event_loop();
+        }
+        else if (config.mode == Config::SM_IOURING)
+        {
+            server.run_io_uring();
+        }
         else
         {
             throw ConfigError("Unsupported server runtime option");
@@ -0,0 +1,146 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+#include "server/BodySpool.hpp"
+#include "http/HttpStatus.hpp"
+#include "error/RequestError.hpp"
+#include "Utils.hpp"
+
+BodySpool::BodySpool(size_t memory_limit) :
+    m_memory_limit(memory_limit),
+    m_file(-1),
+    m_size(0),
+    m_read(0)
+{
+
+}
+
+BodySpool::~BodySpool()
+{
+    clear();
+}
+
+void BodySpool::append(char const* data, size_t size)
+{
+    if (m_file == -1 && m_size + size > m_memory_limit)
+    {
+        spill();
+    }
+
+    if (m_file == -1)
+    {
+        m_memory.insert(m_memory.end(), data, data + size);
+        m_size += size;
+        return;
+    }
+
+    while (size > 0)
+    {
+        ssize_t n = pwrite(m_file, data, size, m_size);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            throw RequestError(HttpStatus::InternalServerError, "Could not write request body to disk\n");
+        }
+        data += n;
+        size -= n;
+        m_size += n;
+    }
+}
+
+size_t BodySpool::read(char* buf, size_t size)
+{
+    size = std::min(size, m_size - m_read);
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    if (m_file == -1)
+    {
+        std::memcpy(buf, m_memory.data() + m_read, size);
+        m_read += size;
+        return size;
+    }
+
+    ssize_t n;
+    while ((n = pread(m_file, buf, size, m_read)) == -1 && errno == EINTR)
+    {
+        continue;
+    }
+    if (n <= 0)
+    {
+        throw RequestError(HttpStatus::InternalServerError, "Could not read request body back from disk\n");
+    }
+    m_read += n;
+    return n;
+}
+
+size_t BodySpool::size() const noexcept
+{
+    return m_size;
+}
+
+size_t BodySpool::unread() const noexcept
+{
+    return m_size - m_read;
+}
+
+bool BodySpool::on_disk() const noexcept
+{
+    return m_file != -1;
+}
+
+void BodySpool::clear() noexcept
+{
+    if (m_file != -1)
+    {
+        close(m_file);
+        m_file = -1;
+    }
+    m_memory.clear();
+    m_size = 0;
+    m_read = 0;
+}
+
+void BodySpool::spill()
+{
+    char const* dir = getenv("TMPDIR");
+    if (dir == nullptr || *dir == '\0')
+    {
+        dir = "/tmp";
+    }
+
+    // an O_TMPFILE file has no name to clean up, otherwise the name goes right after mkstemp
+    m_file = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (m_file == -1)
+    {
+        std::string name = std::string(dir) + "/http-body-XXXXXX";
+        m_file = mkostemp(&name[0], O_CLOEXEC);
+        if (m_file != -1)
+        {
+            unlink(name.c_str());
+        }
+    }
+    if (m_file == -1)
+    {
+        d_errorf("Could not create a file for a request body in %s: %s", dir, strerror(errno));
+        throw RequestError(HttpStatus::InternalServerError, "Could not spool request body\n");
+    }
+
+    d_printf("Spooling a request body to disk on %d", m_file);
+
+    // with m_file open, append() writes to it and leaves m_memory alone
+    size_t held = m_size;
+    m_size = 0;
+    append(m_memory.data(), held);
+    m_memory.clear();
+}
@@ -0,0 +1,194 @@
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <climits>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include "server/DirWatcher.hpp"
+#include "Utils.hpp"
+
+// what changes the contents of a file or which file a path names
+static uint32_t const watched_events = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                                     | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+DirWatcher::DirWatcher(std::string const& dir) :
+    m_dir(dir),
+    m_watching(false),
+    m_inotify(-1),
+    m_stop(-1),
+    m_generation(0)
+{
+    char resolved[PATH_MAX];
+    if (realpath(dir.c_str(), resolved) != nullptr)
+    {
+        m_dir = resolved;
+    }
+}
+
+DirWatcher::~DirWatcher()
+{
+    if (m_thread.joinable())
+    {
+        uint64_t one = 1;
+        if (write(m_stop, &one, sizeof(one)) == sizeof(one))
+        {
+            m_thread.join();
+        }
+        else
+        {
+            m_thread.detach();
+        }
+    }
+    if (m_inotify != -1) close(m_inotify);
+    if (m_stop != -1) close(m_stop);
+}
+
+void DirWatcher::listen(Listener listener)
+{
+    m_listeners.push_back(std::move(listener));
+}
+
+bool DirWatcher::start()
+{
+    std::call_once(m_started, [this]
+    {
+        m_inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        m_stop = eventfd(0, EFD_CLOEXEC);
+        if (m_inotify == -1 || m_stop == -1)
+        {
+            d_warnf("Could not watch %s: %s", m_dir.c_str(), strerror(errno));
+            return;
+        }
+
+        watch(m_dir);
+        if (m_watches.empty())
+        {
+            return;
+        }
+
+        m_thread = std::thread([this] { watch_events(); });
+        m_watching = true;
+    });
+
+    return m_watching;
+}
+
+uint64_t DirWatcher::generation() const noexcept
+{
+    return m_generation.load();
+}
+
+void DirWatcher::watch(std::string const& dir)
+{
+    int wd = inotify_add_watch(m_inotify, dir.c_str(), watched_events | IN_ONLYDIR);
+    if (wd == -1)
+    {
+        d_warnf("Could not watch %s: %s", dir.c_str(), strerror(errno));
+        return;
+    }
+    m_watches[wd] = dir;
+
+    // inotify only reports on the directory itself, so every directory below it gets a watch too
+    DIR* listing = opendir(dir.c_str());
+    if (listing == nullptr)
+    {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(listing)) != nullptr)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        std::string path = dir + "/" + entry->d_name;
+        struct stat st;
+        if (entry->d_type == DT_DIR || (entry->d_type == DT_UNKNOWN && lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)))
+        {
+            watch(path);
+        }
+    }
+    closedir(listing);
+}
+
+void DirWatcher::watch_events()
+{
+    // aligned for the inotify_event structs read into it
+    alignas(struct inotify_event) char buf[16384];
+    struct pollfd fds[2] = { { m_inotify, POLLIN, 0 }, { m_stop, POLLIN, 0 } };
+
+    while (true)
+    {
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+
+        ssize_t n = read(m_inotify, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            continue;
+        }
+
+        for (char* at = buf; at < buf + n; )
+        {
+            struct inotify_event const* event = (struct inotify_event const*) at;
+            at += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // events were lost, so anything could have changed
+                changed("");
+                continue;
+            }
+
+            auto found = m_watches.find(event->wd);
+            if (found == m_watches.end())
+            {
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                m_watches.erase(found);
+                continue;
+            }
+
+            std::string dir = found->second;
+            if (event->mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF))
+            {
+                // a directory appearing, going or moving changes what every path below it names
+                if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                {
+                    watch(dir + "/" + event->name);
+                }
+                changed("");
+            }
+            else if (event->len > 0)
+            {
+                changed(dir + "/" + event->name);
+            }
+        }
+    }
+}
+
+void DirWatcher::changed(std::string const& path)
+{
+    m_generation.fetch_add(1);
+    for (Listener const& listener : m_listeners)
+    {
+        listener(path);
+    }
+}
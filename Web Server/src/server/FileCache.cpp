@@ -0,0 +1,160 @@
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "server/FileCache.hpp"
+#include "http/Validators.hpp"
+#include "Utils.hpp"
+
+FileCache::FileCache(DirWatcher& watcher, size_t max_bytes) :
+    m_watcher(watcher),
+    m_shard_bytes(max_bytes / m_shard_count),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0),
+    m_invalidations(0)
+{
+    m_watcher.listen([this](std::string const& path) { invalidate(path); });
+}
+
+FileCache::Shard& FileCache::shard(std::string const& path) noexcept
+{
+    return m_shards[std::hash<std::string>()(path) % m_shard_count];
+}
+
+std::shared_ptr<FileCache::Entry const> FileCache::find(std::string const& path)
+{
+    if (m_shard_bytes == 0)
+    {
+        return nullptr;
+    }
+
+    // only trusted while the directory is watched, which starts with the first lookup
+    if (!m_watcher.start())
+    {
+        return nullptr;
+    }
+
+    Shard& s = shard(path);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(path);
+    if (found == s.index.end())
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    s.lru.splice(s.lru.begin(), s.lru, found->second);
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return found->second->second;
+}
+
+std::shared_ptr<FileCache::Entry const> FileCache::load(std::string const& path, int fd, struct stat const& st,
+                                                        std::string_view content_type)
+{
+    // a quarter of a shard at most, so one file can not empty a shard on its own
+    size_t size = st.st_size;
+    if (!m_watcher.start() || size > m_shard_bytes / 4)
+    {
+        return nullptr;
+    }
+
+    uint64_t generation = m_watcher.generation();
+
+    auto entry = std::make_shared<Entry>();
+    entry->data.resize(size);
+    size_t read = 0;
+    while (read < size)
+    {
+        ssize_t n = pread(fd, &entry->data[read], size - read, read);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return nullptr;
+        }
+        read += n;
+    }
+
+    entry->etag = Validators::strong_etag(entry->data.data(), size);
+    entry->last_modified = Validators::http_date(st.st_mtime);
+    entry->mtime = st.st_mtime;
+    entry->headers = "Content-Length: " + std::to_string(size) + "\r\nContent-Type: ";
+    entry->headers.append(content_type);
+    entry->headers += "\r\nETag: " + entry->etag + "\r\nLast-Modified: " + entry->last_modified + "\r\n";
+
+    Shard& s = shard(path);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (m_watcher.generation() != generation)
+    {
+        // something changed while the file was read, it may be half old and half new
+        return nullptr;
+    }
+
+    auto found = s.index.find(path);
+    if (found != s.index.end())
+    {
+        s.bytes -= found->second->second->data.size();
+        s.lru.erase(found->second);
+        s.index.erase(found);
+    }
+
+    while (s.bytes + size > m_shard_bytes && !s.lru.empty())
+    {
+        s.bytes -= s.lru.back().second->data.size();
+        s.index.erase(s.lru.back().first);
+        s.lru.pop_back();
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    s.lru.emplace_front(path, entry);
+    s.index.emplace(path, s.lru.begin());
+    s.bytes += size;
+    return entry;
+}
+
+FileCache::Stats FileCache::stats() const noexcept
+{
+    Stats stats{ m_hits.load(), m_misses.load(), m_evictions.load(), m_invalidations.load(), 0, 0 };
+    for (Shard const& s : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        stats.files += s.index.size();
+        stats.bytes += s.bytes;
+    }
+    return stats;
+}
+
+void FileCache::invalidate(std::string const& path)
+{
+    if (path.empty())
+    {
+        invalidate_all();
+        return;
+    }
+
+    Shard& s = shard(path);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(path);
+    if (found != s.index.end())
+    {
+        s.bytes -= found->second->second->data.size();
+        s.lru.erase(found->second);
+        s.index.erase(found);
+        m_invalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void FileCache::invalidate_all()
+{
+    for (Shard& s : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        m_invalidations.fetch_add(s.index.size(), std::memory_order_relaxed);
+        s.index.clear();
+        s.lru.clear();
+        s.bytes = 0;
+    }
+}
@@ -0,0 +1,246 @@
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "server/IoUring.hpp"
+#include "error/ConfigError.hpp"
+#include "error/SocketError.hpp"
+#include "Utils.hpp"
+
+// every opcode the io_uring server mode submits
+static int const required_ops[] = {
+    IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READ, IORING_OP_FILES_UPDATE,
+    IORING_OP_TIMEOUT
+};
+
+IoUring::IoUring(unsigned entries) :
+    m_fd(-1),
+    m_sq_ring(MAP_FAILED),
+    m_sq_ring_size(0),
+    m_cq_ring(MAP_FAILED),
+    m_cq_ring_size(0),
+    m_sqes((struct io_uring_sqe*) MAP_FAILED),
+    m_sqes_size(0),
+    m_to_submit(0),
+    m_buf_ring((struct io_uring_buf_ring*) MAP_FAILED),
+    m_buf_ring_size(0),
+    m_buf_entries(0),
+    m_buf_size(0)
+{
+    memset(&m_params, 0, sizeof(m_params));
+
+    m_fd = syscall(__NR_io_uring_setup, entries, &m_params);
+    if (m_fd == -1)
+    {
+        throw ConfigError(std::string("io_uring is not available on this system: io_uring_setup(): ") + strerror(errno));
+    }
+
+    if (!(m_params.features & IORING_FEAT_NODROP) || !(m_params.features & IORING_FEAT_FAST_POLL))
+    {
+        close(m_fd);
+        throw ConfigError("io_uring on this kernel is too old for --io-uring (need Linux 5.19 or newer)");
+    }
+
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*) calloc(1, probe_size);
+    bool supported = syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (int op : required_ops)
+    {
+        supported = supported && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+
+    if (!supported)
+    {
+        close(m_fd);
+        throw ConfigError("io_uring on this kernel is missing operations --io-uring needs (need Linux 5.19 or newer)");
+    }
+
+    m_sq_ring_size = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(struct io_uring_cqe);
+    if (m_params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+
+    m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ring == MAP_FAILED)
+    {
+        close(m_fd);
+        throw SocketError("mmap");
+    }
+
+    if (m_params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_cq_ring = m_sq_ring;
+    }
+    else
+    {
+        m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED)
+        {
+            munmap(m_sq_ring, m_sq_ring_size);
+            close(m_fd);
+            throw SocketError("mmap");
+        }
+    }
+
+    m_sqes_size = m_params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe*) mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        if (m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+        munmap(m_sq_ring, m_sq_ring_size);
+        close(m_fd);
+        throw SocketError("mmap");
+    }
+
+    char* sq = (char*) m_sq_ring;
+    m_sq_head = (unsigned*) (sq + m_params.sq_off.head);
+    m_sq_tail = (unsigned*) (sq + m_params.sq_off.tail);
+    m_sq_mask = *(unsigned*) (sq + m_params.sq_off.ring_mask);
+    m_sq_array = (unsigned*) (sq + m_params.sq_off.array);
+
+    char* cq = (char*) m_cq_ring;
+    m_cq_head = (unsigned*) (cq + m_params.cq_off.head);
+    m_cq_tail = (unsigned*) (cq + m_params.cq_off.tail);
+    m_cq_mask = *(unsigned*) (cq + m_params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe*) (cq + m_params.cq_off.cqes);
+}
+
+IoUring::~IoUring() noexcept
+{
+    if (m_buf_ring != MAP_FAILED) munmap(m_buf_ring, m_buf_ring_size);
+    munmap(m_sqes, m_sqes_size);
+    if (m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+    munmap(m_sq_ring, m_sq_ring_size);
+
+    if (close(m_fd) == -1) d_error("Could not close io_uring");
+}
+
+int IoUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int ret;
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+
+    return ret;
+}
+
+void IoUring::register_file_slots(unsigned count)
+{
+    std::vector<int> fds(count, -1);
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_FILES, fds.data(), count) == -1)
+    {
+        throw SocketError("io_uring_register");
+    }
+}
+
+void IoUring::provide_buffers(unsigned entries, unsigned size)
+{
+    // the kernel wants a power of two number of entries in a page aligned ring
+    m_buf_ring_size = entries * sizeof(struct io_uring_buf);
+    m_buf_ring = (struct io_uring_buf_ring*) mmap(NULL, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (m_buf_ring == MAP_FAILED)
+    {
+        throw SocketError("mmap");
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) m_buf_ring;
+    reg.ring_entries = entries;
+    reg.bgid = buf_group;
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        throw ConfigError(std::string("io_uring on this kernel has no provided buffer rings (need Linux 5.19 or newer): ") + strerror(errno));
+    }
+
+    m_buf_entries = entries;
+    m_buf_size = size;
+    m_bufs.resize((size_t) entries * size);
+
+    m_buf_ring->tail = 0;
+    for (unsigned short bid = 0; bid < entries; bid++)
+    {
+        recycle_buffer(bid);
+    }
+}
+
+char const* IoUring::buffer(unsigned short bid) const noexcept
+{
+    return m_bufs.data() + (size_t) bid * m_buf_size;
+}
+
+void IoUring::recycle_buffer(unsigned short bid) noexcept
+{
+    // The ring is indexed by hand: in C++ the header's flexible bufs member does not
+    // start at offset 0 the way the kernel expects.
+    unsigned short tail = m_buf_ring->tail;
+    struct io_uring_buf* buf = (struct io_uring_buf*) m_buf_ring + (tail & (m_buf_entries - 1));
+
+    buf->addr = (unsigned long) buffer(bid);
+    buf->len = m_buf_size;
+    buf->bid = bid;
+
+    __atomic_store_n(&m_buf_ring->tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* IoUring::get_sqe()
+{
+    unsigned tail = *m_sq_tail;
+    while (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_params.sq_entries)
+    {
+        if (enter(m_to_submit, 0, 0) == -1)
+        {
+            throw SocketError("io_uring_enter");
+        }
+        m_to_submit = 0;
+    }
+
+    unsigned index = tail & m_sq_mask;
+    struct io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    // Nothing reads the SQE before the next io_uring_enter(), so it is fine to
+    // publish it now and let the caller fill it in afterwards.
+    m_sq_array[index] = index;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    m_to_submit++;
+
+    return sqe;
+}
+
+void IoUring::submit_and_wait()
+{
+    if (enter(m_to_submit, 1, IORING_ENTER_GETEVENTS) == -1)
+    {
+        // EBUSY means completions have to be reaped before more can be submitted
+        if (errno != EBUSY) throw SocketError("io_uring_enter");
+        return;
+    }
+    m_to_submit = 0;
+}
+
+struct io_uring_cqe* IoUring::peek_cqe() noexcept
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return nullptr;
+    }
+
+    return &m_cqes[head & m_cq_mask];
+}
+
+void IoUring::cqe_seen() noexcept
+{
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,125 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "server/MappedFiles.hpp"
+#include "Utils.hpp"
+
+MappedFiles::Mapping::Mapping(char const* data, size_t size, int fd, struct stat const& st) noexcept :
+    data(data),
+    size(size),
+    m_fd(fd),
+    m_mtime(st.st_mtim)
+{
+
+}
+
+MappedFiles::Mapping::~Mapping()
+{
+    munmap((void*) data, size);
+    close(m_fd);
+}
+
+bool MappedFiles::Mapping::current() const noexcept
+{
+    // fstat() on the file that was mapped, a replaced file shows up as unlinked
+    struct stat st;
+    return fstat(m_fd, &st) == 0 && st.st_nlink > 0 && (size_t) st.st_size == size
+        && st.st_mtim.tv_sec == m_mtime.tv_sec && st.st_mtim.tv_nsec == m_mtime.tv_nsec;
+}
+
+MappedFiles::MappedFiles(size_t max_mappings) :
+    m_max_mappings(max_mappings)
+{
+
+}
+
+std::shared_ptr<MappedFiles::Mapping const> MappedFiles::find(std::string const& path)
+{
+    if (m_max_mappings == 0)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<Mapping const> mapping;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_index.find(path);
+        if (found == m_index.end())
+        {
+            return nullptr;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, found->second);
+        mapping = found->second->second;
+    }
+
+    // checked without the lock, the reference keeps the file open
+    if (!mapping->current())
+    {
+        d_printf("%s changed since it was mapped", path.c_str());
+        erase(path, mapping.get());
+        return nullptr;
+    }
+    return mapping;
+}
+
+std::shared_ptr<MappedFiles::Mapping const> MappedFiles::map(std::string const& path, int fd, struct stat const& st)
+{
+    if (m_max_mappings == 0 || st.st_size == 0)
+    {
+        return nullptr;
+    }
+
+    // the mapping keeps a descriptor of its own to fstat() later
+    int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own == -1)
+    {
+        return nullptr;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, own, 0);
+    if (data == MAP_FAILED)
+    {
+        d_warnf("Could not map %s", path.c_str());
+        close(own);
+        return nullptr;
+    }
+
+    // responses read it front to back, starting right away
+    madvise(data, st.st_size, MADV_WILLNEED);
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    auto mapping = std::make_shared<Mapping const>((char const*) data, st.st_size, own, st);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_index.find(path);
+    if (found != m_index.end())
+    {
+        m_lru.erase(found->second);
+        m_index.erase(found);
+    }
+
+    // the table lets go of old mappings, responses still sending from them keep them alive
+    while (m_lru.size() >= m_max_mappings)
+    {
+        m_index.erase(m_lru.back().first);
+        m_lru.pop_back();
+    }
+
+    m_lru.emplace_front(path, mapping);
+    m_index.emplace(path, m_lru.begin());
+    return mapping;
+}
+
+void MappedFiles::erase(std::string const& path, Mapping const* mapping)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_index.find(path);
+
+    // another thread may have mapped the file again in the meantime
+    if (found != m_index.end() && found->second->second.get() == mapping)
+    {
+        m_lru.erase(found->second);
+        m_index.erase(found);
+    }
+}
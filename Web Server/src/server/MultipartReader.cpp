@@ -0,0 +1,177 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "server/MultipartReader.hpp"
+#include "server/Request.hpp"
+#include "http/HttpStatus.hpp"
+#include "error/RequestError.hpp"
+#include "Utils.hpp"
+
+MultipartReader::MultipartReader(Request const& req, std::string_view boundary) :
+    m_req(req),
+    m_parser(boundary),
+    m_start(0),
+    m_end(0),
+    m_in_part(false),
+    m_done(false)
+{
+
+}
+
+MultipartParser::Result MultipartReader::step()
+{
+    while (true)
+    {
+        size_t used;
+        std::string_view piece;
+        MultipartParser::Result result = m_parser.parse(m_buffer + m_start, m_end - m_start, used, piece);
+        m_start += used;
+
+        if (result == MultipartParser::MULTIPART_ERROR)
+        {
+            throw RequestError(m_parser.error(), m_parser.error_text());
+        }
+        if (result == MultipartParser::MULTIPART_DATA)
+        {
+            m_piece = piece;
+        }
+        if (result != MultipartParser::MULTIPART_INCOMPLETE)
+        {
+            return result;
+        }
+
+        // what the parser left is at most a header line or the start of a boundary,
+        // so moving it to the front always leaves room to read into
+        std::memmove(m_buffer, m_buffer + m_start, m_end - m_start);
+        m_end -= m_start;
+        m_start = 0;
+
+        size_t read = m_req.read_body(m_buffer + m_end, m_buffer_size - m_end);
+        if (read == 0)
+        {
+            throw RequestError(HttpStatus::BadRequest, "Multipart body ends before its closing boundary\n");
+        }
+        m_end += read;
+    }
+}
+
+bool MultipartReader::next_part()
+{
+    std::string_view piece;
+    while (m_in_part && next_piece(piece))
+    {
+        continue;
+    }
+
+    while (!m_done)
+    {
+        switch (step())
+        {
+        case MultipartParser::MULTIPART_PART:
+            m_in_part = true;
+            return true;
+        case MultipartParser::MULTIPART_DONE:
+            m_done = true;
+            break;
+        default:
+            // nothing but a part or the end can follow a boundary
+            break;
+        }
+    }
+    return false;
+}
+
+bool MultipartReader::next_piece(std::string_view& piece)
+{
+    if (m_piece.empty() && m_in_part)
+    {
+        if (step() == MultipartParser::MULTIPART_END)
+        {
+            m_in_part = false;
+        }
+    }
+
+    piece = m_piece;
+    m_piece = std::string_view();
+    return !piece.empty();
+}
+
+std::string const& MultipartReader::name() const noexcept
+{
+    return m_parser.name();
+}
+
+std::string const& MultipartReader::filename() const noexcept
+{
+    return m_parser.filename();
+}
+
+std::string const& MultipartReader::content_type() const noexcept
+{
+    return m_parser.content_type();
+}
+
+size_t MultipartReader::read(char* buf, size_t size)
+{
+    std::string_view piece;
+    if (size == 0 || !next_piece(piece))
+    {
+        return 0;
+    }
+
+    // a piece bigger than buf is handed out over several calls
+    size = std::min(size, piece.size());
+    std::memcpy(buf, piece.data(), size);
+    m_piece = piece.substr(size);
+    return size;
+}
+
+std::string MultipartReader::save(std::string const& dir, size_t& size)
+{
+    std::string path = dir + "/http-upload-XXXXXX";
+    int fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd == -1)
+    {
+        d_errorf("Could not create a file for an upload in %s: %s", dir.c_str(), strerror(errno));
+        throw RequestError(HttpStatus::InternalServerError, "Could not save upload\n");
+    }
+
+    size = 0;
+    try
+    {
+        // pieces go from the buffer to the file, nothing of the part is kept
+        std::string_view piece;
+        while (next_piece(piece))
+        {
+            while (!piece.empty())
+            {
+                ssize_t n = write(fd, piece.data(), piece.size());
+                if (n == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    d_errorf("Could not write upload to %s: %s", path.c_str(), strerror(errno));
+                    throw RequestError(HttpStatus::InternalServerError, "Could not save upload\n");
+                }
+                piece.remove_prefix(n);
+                size += n;
+            }
+        }
+    }
+    catch (...)
+    {
+        close(fd);
+        unlink(path.c_str());
+        throw;
+    }
+
+    close(fd);
+    d_printf("Saved %zu byte upload to %s", size, path.c_str());
+    return path;
+}
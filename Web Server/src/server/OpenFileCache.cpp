@@ -0,0 +1,100 @@
+#include <unistd.h>
+#include <algorithm>
+
+#include "server/OpenFileCache.hpp"
+#include "server/TimerWheel.hpp"
+#include "http/Validators.hpp"
+
+OpenFileCache::File::File(std::string resolved, int fd, struct stat const& st) :
+    resolved(std::move(resolved)),
+    fd(fd),
+    st(st)
+{
+    if (fd != -1)
+    {
+        etag = Validators::weak_etag(st);
+        last_modified = Validators::http_date(st.st_mtime);
+    }
+}
+
+OpenFileCache::File::~File()
+{
+    if (fd != -1) close(fd);
+}
+
+bool OpenFileCache::File::exists() const noexcept
+{
+    return fd != -1;
+}
+
+OpenFileCache::OpenFileCache(DirWatcher& watcher, size_t max_files, long ttl_ms) :
+    m_watcher(watcher),
+    m_shard_files(max_files == 0 ? 0 : std::max<size_t>(max_files / m_shard_count, 1)),
+    m_ttl_ms(ttl_ms)
+{
+
+}
+
+OpenFileCache::Shard& OpenFileCache::shard(std::string_view requested) noexcept
+{
+    return m_shards[std::hash<std::string_view>()(requested) % m_shard_count];
+}
+
+std::shared_ptr<OpenFileCache::File const> OpenFileCache::find(std::string_view requested)
+{
+    if (m_shard_files == 0)
+    {
+        return nullptr;
+    }
+
+    // without inotify the generation never moves and only the ttl retires entries
+    m_watcher.start();
+
+    Shard& s = shard(requested);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(requested);
+    if (found == s.index.end())
+    {
+        return nullptr;
+    }
+
+    Node& node = *found->second;
+    if (node.generation != m_watcher.generation() || TimerWheel::now_ms() >= node.expires)
+    {
+        s.lru.erase(found->second);
+        s.index.erase(found);
+        return nullptr;
+    }
+
+    s.lru.splice(s.lru.begin(), s.lru, found->second);
+    return node.file;
+}
+
+std::shared_ptr<OpenFileCache::File const> OpenFileCache::insert(std::string_view requested, std::shared_ptr<File const> file,
+                                                                 uint64_t generation)
+{
+    if (m_shard_files == 0 || m_watcher.generation() != generation)
+    {
+        return file;
+    }
+
+    Shard& s = shard(requested);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(requested);
+    if (found != s.index.end())
+    {
+        auto node = found->second;
+        s.index.erase(found);
+        s.lru.erase(node);
+    }
+
+    while (s.lru.size() >= m_shard_files)
+    {
+        s.index.erase(s.lru.back().requested);
+        s.lru.pop_back();
+    }
+
+    s.lru.push_front(Node{ std::string(requested), file, generation, TimerWheel::now_ms() + m_ttl_ms });
+    s.index.emplace(s.lru.front().requested, s.lru.begin());
+    return file;
+}
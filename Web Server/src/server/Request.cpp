@@ -6,10 +6,18 @@
 #include <cassert>
 #include <cstdlib>
 #include <stdexcept>
+#include <algorithm>
+#include <strings.h>
+#include <charconv>
+#include <unistd.h>
 
 #include "server/Request.hpp"
+#include "http/HttpParser.hpp"
+#include "http/CharScan.hpp"
 #include "http/HttpStatus.hpp"
 #include "server/TcpConnection.hpp"
+#include "server/MultipartReader.hpp"
+#include "http/MultipartParser.hpp"
 #include "Config.hpp"
 #include "Utils.hpp"
 #include "error/RequestError.hpp"
@@ -18,239 +26,530 @@
 
 
 Request::Request(Config const& config, TcpConnection& conn) :
-    m_config(config),
-    m_conn(conn)
+  m_config(config),
+  m_conn(conn),
+  m_arena(conn.arena()),
+  m_head(m_arena),
+  m_headers(m_arena),
+  m_raw_body(m_arena),
+  m_query(m_arena),
+  m_body_data(m_arena),
+  m_query_parsed(false),
+  m_body_parsed(false),
+  m_path(m_arena),
+  m_method(m_arena),
+  m_version(m_arena)
 {
-    std::string request_line = parse_raw_line();
-    parse_method(request_line);
-    parse_route(request_line);
-    parse_version(request_line);
+  // the whole head has to arrive within the header timeout, the body within its own
+  m_conn.set_read_deadline(m_config.header_timeout * 1000);
 
-    // the previous three parse_* calls should consume the entire line
-    if (!request_line.empty())
+  parse_head();
+
+  // handlers read the body, so its deadline stays until the request is done
+  m_conn.set_read_deadline(m_config.body_timeout * 1000);
+  parse_body();
+}
+
+Request::~Request()
+{
+  m_conn.set_read_deadline(-1);
+
+  for (Upload const& upload : m_uploads)
+  {
+    if (unlink(upload.path.c_str()) == -1)
     {
-        throw RequestError(HttpStatus::BadRequest, "Malformed request-line\n");
+      d_warnf("Could not remove upload %s", upload.path.c_str());
     }
-    
-    parse_headers();
-    parse_body();
+  }
 }
 
-void Request::parse_method(std::string& raw_line)
+size_t Request::buffered_length(Config const& config, TcpConnection& conn) noexcept
 {
-  
-  m_method = raw_line.substr(0, 3);
-  
-  if (m_method.compare("GET") != 0)
+  HttpParser& parser = conn.parser();
+  size_t size = conn.buffered_size();
+
+  switch (parser.parse(conn.buffered_data(), size))
+  {
+  case HttpParser::PARSE_INCOMPLETE:
+    return 0;
+  case HttpParser::PARSE_ERROR:
+    return size;
+  case HttpParser::PARSE_DONE:
+    break;
+  }
+
+  size_t head = parser.head_length();
+  BodyDecoder& body = conn.body_decoder();
+  if (!body.started())
+  {
+    start_body(config, parser, body);
+  }
+
+  // the body goes to the spool as it arrives, which leaves the head where the parser saw it
+  try
   {
-    m_method = raw_line.substr(0, 4);
-    if (m_method.compare("POST") != 0)
+    while (true)
     {
-      throw RequestError(HttpStatus::MethodNotAllowed, "Method not allowed\n");
+      size_t used;
+      std::string_view piece;
+      BodyDecoder::Result result = body.decode(conn.buffered_data() + head, conn.buffered_size() - head,
+                                               SIZE_MAX, used, piece);
+      conn.spool().append(piece.data(), piece.size());
+      conn.erase_buffered(head, used);
+
+      if (result != BodyDecoder::BODY_INCOMPLETE)
+      {
+        return head;
+      }
+      if (used == 0)
+      {
+        return 0;
+      }
     }
   }
+  catch (RequestError const& e)
+  {
+    body.fail(e.status, "Could not spool request body\n");
+    return head;
+  }
+}
 
-  raw_line = raw_line.substr(m_method.length() + 1);
-  
-  //throw TodoError("2", "You have to implement parsing methods");
+bool Request::head_buffered(TcpConnection& conn) noexcept
+{
+  return conn.parser().parse(conn.buffered_data(), conn.buffered_size()) != HttpParser::PARSE_INCOMPLETE;
 }
 
-void Request::parse_route(std::string& raw_line)
+void Request::parse_head()
 {
-  size_t pos = raw_line.find("/");
-  size_t end = raw_line.find(" ");
-  bool flag  = false;
-  if (raw_line.find("?") != std::string::npos) flag = true;
-  
-  if (pos == std::string::npos)
+  HttpParser& parser = m_conn.parser();
+
+  HttpParser::Result result;
+  while ((result = parser.parse(m_conn.buffered_data(), m_conn.buffered_size())) == HttpParser::PARSE_INCOMPLETE)
   {
-    throw RequestError(HttpStatus::BadRequest, "Malformed request-line\n");
+    if (!m_conn.read_more())
+    {
+      throw ConnectionError("Connection error\n");
+    }
   }
 
-  if (flag == true) end = raw_line.find("?");
+  if (result == HttpParser::PARSE_ERROR)
+  {
+    throw RequestError(parser.error(), parser.error_text());
+  }
+
+  // the parser only points into the receive buffer, which moves on once the head is consumed
+  char const* received = m_conn.buffered_data();
+  m_head.assign(received, parser.head_length());
+  auto copied = [this, received](std::string_view view)
+  {
+    return std::string_view(m_head.data() + (view.data() - received), view.length());
+  };
+
+  m_method = parser.method();
+  m_path = parser.path();
+  m_version = parser.version();
+  m_raw_query = copied(parser.query());
 
-  m_path   = raw_line.substr((int) pos, (int) end - (int) pos);
-  raw_line = raw_line.substr(m_path.length() + 1);
-  if (flag == true)
+  for (size_t i = 0; i < parser.header_count(); i++)
   {
-    size_t end        = raw_line.find(" ");
-    std::string query = raw_line.substr(0, end - 1);
-    parse_querystring(raw_line, m_query);
-    raw_line = raw_line.substr(end + 1);
+    m_headers.set(parser.header_id(i), copied(parser.header_name(i)), copied(parser.header_value(i)));
   }
-  //throw TodoError("2", "You have to implement parsing routes");
-}
 
-void Request::parse_querystring(std::string query, std::unordered_map<std::string, std::string>& parsed)
-{
-  size_t amp = query.find("&");
-  while (amp != std::string::npos)
+  // the body is framed by the head, which is about to be gone from the receive buffer
+  BodyDecoder& body = m_conn.body_decoder();
+  if (!body.started())
   {
-    std::string query_item = query.substr(0, amp - 1);
-    std::string word1      = query_item.substr(0, query_item.find("=") - 1);
-    std::string word2      = query_item.substr(query_item.find("=") + 1, amp - 1);
-    parsed[word1]          = word2;
-    
-    query = query.substr(amp + 1);
-    amp   = query.find("&");
+    start_body(m_config, parser, body);
   }
 
-  std::string word1 = query.substr(0, query.find("=") - 1);
-  std::string word2 = query.substr(query.find("=") + 1);
-  parsed[word1]     = word2;
-  
-  //throw TodoError("6", "You have to implement parsing querystrings");
+  m_conn.consume(parser.head_length());
+  parser.reset();
 }
 
-void Request::parse_version(std::string& raw_line)
+static int hex_value(char c) noexcept
 {
-  if      (raw_line.find("HTTP/1.0") != std::string::npos) m_version = "HTTP/1.0";
-  else if (raw_line.find("HTTP/1.1") != std::string::npos) m_version = "HTTP/1.1";
-  else    throw RequestError(HttpStatus::HttpVersionNotSupported, "Version not supported\n");
-  raw_line = raw_line.substr(m_version.length() + 2);
-
-  //throw TodoError("2", "You have to implement parsing HTTP version");
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
 }
 
-void Request::parse_headers()
+void Request::parse_querystring(std::string_view query, Table& parsed) const
 {
-  std::string raw_line = parse_raw_line();
-  while (raw_line.length() != 2)
+  String key(m_arena);
+  String value(m_arena);
+  String* part = &key;
+
+  size_t i = 0;
+  while (true)
   {
-    size_t pos        = raw_line.find(":");
-    std::string key   = raw_line.substr(0, pos - 1);
-    std::string value = raw_line.substr(pos + 1, raw_line.length() - 2 - pos - 1);
-    m_headers[key]    = value;
-    raw_line = parse_raw_line();
+    // copy the run of bytes that need no decoding in one go
+    size_t run = CharScan::span(query.data() + i, query.length() - i, CharScan::query_plain);
+    part->append(query.data() + i, run);
+    i += run;
+
+    if (i == query.length() || query[i] == '&')
+    {
+      // a key without '=' gets an empty value, empty items are skipped
+      if (!key.empty() || part == &value)
+      {
+        parsed.insert_or_assign(std::move(key), std::move(value));
+        key.clear();
+        value.clear();
+      }
+      if (i == query.length()) break;
+      part = &key;
+    }
+    else if (query[i] == '=')
+    {
+      if (part == &key) part = &value;
+      else part->push_back('=');
+    }
+    else if (query[i] == '+')
+    {
+      part->push_back(' ');
+    }
+    else
+    {
+      // a '%' not followed by two hex digits stands for itself
+      int high = i + 2 < query.length() ? hex_value(query[i + 1]) : -1;
+      int low = high >= 0 ? hex_value(query[i + 2]) : -1;
+      if (low >= 0)
+      {
+        part->push_back((char) (high << 4 | low));
+        i += 2;
+      }
+      else
+      {
+        part->push_back('%');
+      }
+    }
+    i++;
   }
-  //throw TodoError("2", "You have to implement parsing headers");
+  
+  //throw TodoError("6", "You have to implement parsing querystrings");
 }
 
-void Request::parse_body()
+void Request::start_body(Config const& config, HttpParser const& parser, BodyDecoder& body) noexcept
 {
-  if (m_method == "GET") return;
+  if (parser.method() != "POST")
+  {
+    body.expect_none();
+    return;
+  }
 
-  if (m_headers["Content-Type"] != "application/x-www-form-urlencoded")
+  // chunked wins over a Content-Length, and has to be the only coding since nothing else can be undone here
+  std::string_view value;
+  if (parser.find_header(HeaderTable::TRANSFER_ENCODING, value))
   {
-    throw RequestError(HttpStatus::UnsupportedMediaType, "Unsupported media type\n");
+    if (value.length() == 7 && strncasecmp(value.data(), "chunked", 7) == 0)
+    {
+      body.expect_chunked(config.max_body);
+    }
+    else
+    {
+      body.fail(HttpStatus::BadRequest, "Unsupported transfer coding\n");
+    }
+    return;
   }
 
-  unsigned char c;
-  int count  = 0;
-  int length = stoi(m_headers["Content-Length"], nullptr, 10);
-  char body[length + 1];
-  
-  if (length > 4096)
+  long length = -1;
+  if (parser.find_header(HeaderTable::CONTENT_LENGTH, value))
   {
-    throw RequestError(HttpStatus::Forbidden, "Forbidden\n");
+    auto parsed = std::from_chars(value.data(), value.data() + value.size(), length);
+    if (parsed.ec != std::errc() || parsed.ptr != value.data() + value.size())
+    {
+      length = -1;
+    }
   }
 
-  while (count < length)
+  if (length < 0)
   {
-    m_conn.getc(&c);
-    body[count++] = c;
+    body.fail(HttpStatus::BadRequest, "Bad Content-Length\n");
   }
-  body[count] = '\0';
+  else if (length > config.max_body)
+  {
+    body.fail(HttpStatus::Forbidden, "Forbidden\n");
+  }
+  else
+  {
+    body.expect_length(length);
+  }
+}
 
-  std::string body_data = body;
-  parse_querystring(body_data, m_body_data);  
-  //throw TodoError("6", "You have to implement parsing request bodies");
+void Request::parse_body()
+{
+  BodyDecoder& body = m_conn.body_decoder();
+  if (body.failed())
+  {
+    throw RequestError(body.error(), body.error_text());
+  }
 }
 
-std::string Request::parse_raw_line()
+size_t Request::read_body(char* buf, size_t size) const
 {
-  std::string request_line;
-  unsigned char c;
-  bool getc = true;
-  int bytes = 0;
+  // whatever the event loop set aside comes first
+  size_t spooled = m_conn.spool().read(buf, size);
+  if (spooled > 0)
+  {
+    return spooled;
+  }
 
-  while (bytes < m_max_buf && (getc = m_conn.getc(&c)) != false)
+  BodyDecoder& body = m_conn.body_decoder();
+  while (true)
   {
-    if (c == EOF) return request_line;
+    size_t used;
+    std::string_view piece;
+    BodyDecoder::Result result = body.decode(m_conn.buffered_data(), m_conn.buffered_size(), size, used, piece);
+    if (!piece.empty())
+    {
+      std::memcpy(buf, piece.data(), piece.size());
+    }
+    m_conn.consume(used);
 
-    if (c == '\r')
+    if (result == BodyDecoder::BODY_ERROR)
     {
-      request_line += c;
-      getc = m_conn.getc(&c);
-      if (c == '\n')
-      {
-	request_line += c;
-	return request_line;
-      }
+      throw RequestError(body.error(), body.error_text());
+    }
+    if (!piece.empty() || result == BodyDecoder::BODY_DONE)
+    {
+      return piece.size();
+    }
+    if (used == 0 && !m_conn.read_more())
+    {
+      throw ConnectionError("Connection error\n");
     }
-    request_line += c;
-    bytes++;
   }
-  
-  if (getc == false)
+}
+
+bool Request::discard_body() const noexcept
+{
+  char buf[4096];
+  try
   {
-    throw ConnectionError("Connection error\n");
+    while (read_body(buf, sizeof(buf)) > 0)
+    {
+      continue;
+    }
+    return true;
   }
-  
-  return request_line;
-  //throw TodoError("2", "You need to implement line fetching");
+  catch (RequestError const& e)
+  {
+    d_warnf("Could not read past the request body: %s", e.what());
+  }
+  catch (ConnectionError const& e)
+  {
+    d_warnf("Could not read past the request body: %s", e.what());
+  }
+  return false;
+}
+
+bool Request::content_type_is(std::string_view type) const noexcept
+{
+  std::string_view const* value = find_header(HeaderTable::CONTENT_TYPE);
+  if (value == nullptr)
+  {
+    return false;
+  }
+
+  std::string_view media = value->substr(0, value->find(';'));
+  size_t last = media.find_last_not_of(" \t");
+  media = media.substr(0, last == std::string_view::npos ? 0 : last + 1);
+  return media.length() == type.length() && strncasecmp(media.data(), type.data(), type.length()) == 0;
 }
 
 void Request::print() const noexcept
 {
-    std::cout << m_method << ' ' << m_path << ' ' << m_version << std::endl;
+  std::cout << m_method << ' ' << m_path << ' ' << m_version << std::endl;
 #ifdef DEBUG    
-    for (auto const& el : m_headers)
-    {
-        std::cout << el.first << ": " << el.second << std::endl;
-    }
+  m_headers.for_each([](std::string_view name, std::string_view value)
+  {
+    std::cout << name << ": " << value << std::endl;
+  });
 
-    for (auto const& el : m_query)
-    {
-        std::cerr << el.first << ": " << el.second << std::endl;
-    }
+  // printed as received, decoding it here would defeat get_query() being lazy
+  if (!m_raw_query.empty())
+  {
+    std::cerr << "query: " << m_raw_query << std::endl;
+  }
 
-    for (auto const& el : m_body_data)
-    {
-        std::cerr << el.first << ": " << el.second << std::endl;
-    }
 #endif	
 }
 
 bool Request::try_header(std::string const& key, std::string& value) const noexcept
 {
-    if (m_headers.find(key) == m_headers.end())
-    {
-        return false;
-    }
-    else
+  std::string_view const* found = find_header(key);
+  if (found == nullptr)
+  {
+    return false;
+  }
+  else
+  {
+    value = *found;
+    return true;
+  }
+}
+
+bool Request::try_header(HeaderTable::Id id, std::string& value) const noexcept
+{
+  std::string_view const* found = find_header(id);
+  if (found == nullptr)
+  {
+    return false;
+  }
+  else
+  {
+    value = *found;
+    return true;
+  }
+}
+
+std::string_view const* Request::find_header(HeaderTable::Id id) const noexcept
+{
+  return m_headers.find(id);
+}
+
+std::string_view const* Request::find_header(std::string_view key) const noexcept
+{
+  return m_headers.find(key);
+}
+
+bool Request::keep_alive() const noexcept
+{
+  // HTTP/1.1 connections persist unless the client says otherwise, HTTP/1.0 ones only if it asks
+  bool keep = m_version == "HTTP/1.1";
+
+  std::string_view const* connection = m_headers.find(HeaderTable::CONNECTION);
+  if (connection != nullptr)
+  {
+    // the value is a comma separated list of tokens
+    std::string_view value = *connection;
+    size_t start = 0;
+    while (start < value.length())
     {
-        value = m_headers.at(key);
-        return true;
+      size_t comma = value.find(',', start);
+      if (comma == std::string_view::npos) comma = value.length();
+
+      std::string_view token = value.substr(start, comma - start);
+      size_t first = token.find_first_not_of(" \t");
+      size_t last  = token.find_last_not_of(" \t");
+      if (first != std::string_view::npos)
+      {
+        token = token.substr(first, last - first + 1);
+        if (token.length() == 5 && strncasecmp(token.data(), "close", 5) == 0)       return false;
+        if (token.length() == 10 && strncasecmp(token.data(), "keep-alive", 10) == 0) keep = true;
+      }
+
+      start = comma + 1;
     }
+  }
+
+  return keep;
+}
+
+Request::String const& Request::get_path() const noexcept
+{
+  return m_path;
+}
+
+Request::String const& Request::get_method() const noexcept
+{
+  return m_method;
+}
+
+Request::String const& Request::get_version() const noexcept
+{
+  return m_version;
 }
 
-std::string const& Request::get_path() const noexcept
+HeaderTable const& Request::get_headers() const noexcept
 {
-    return m_path;
+  return m_headers;
 }
 
-std::string const& Request::get_method() const noexcept
+Request::Table const& Request::get_query() const
 {
-    return m_method;
+  if (!m_query_parsed)
+  {
+    parse_querystring(m_raw_query, m_query);
+    m_query_parsed = true;
+  }
+  return m_query;
 }
 
-std::string const& Request::get_version() const noexcept
+Request::Table const& Request::get_body() const
 {
-    return m_version;
+  if (!m_body_parsed)
+  {
+    m_body_parsed = true;
+    if (content_type_is("application/x-www-form-urlencoded"))
+    {
+      // at most max_body bytes, the decoder makes sure of that
+      size_t read;
+      do
+      {
+        size_t at = m_raw_body.size();
+        m_raw_body.resize(at + 4096);
+        read = read_body(&m_raw_body[at], 4096);
+        m_raw_body.resize(at + read);
+      }
+      while (read > 0);
+
+      parse_querystring(m_raw_body, m_body_data);
+    }
+    else if (content_type_is("multipart/form-data"))
+    {
+      parse_multipart();
+    }
+  }
+  return m_body_data;
 }
 
-std::unordered_map<std::string, std::string> const& Request::get_headers() const noexcept
+std::vector<Request::Upload> const& Request::get_uploads() const
 {
-    return m_headers;
+  get_body();
+  return m_uploads;
 }
 
-std::unordered_map<std::string, std::string> const& Request::get_query() const noexcept
+std::vector<Request::Upload> Request::take_uploads() const
 {
-    return m_query;
+  get_body();
+  std::vector<Upload> uploads;
+  uploads.swap(m_uploads);
+  return uploads;
 }
 
-std::unordered_map<std::string, std::string> const& Request::get_body() const noexcept
+void Request::parse_multipart() const
 {
-    return m_body_data;
+  std::string_view boundary;
+  if (!MultipartParser::find_boundary(*find_header(HeaderTable::CONTENT_TYPE), boundary))
+  {
+    throw RequestError(HttpStatus::BadRequest, "Missing multipart boundary\n");
+  }
+
+  MultipartReader reader(*this, boundary);
+  while (reader.next_part())
+  {
+    if (!reader.filename().empty())
+    {
+      Upload upload{ reader.name(), reader.filename(), reader.content_type(), "", 0 };
+      upload.path = reader.save(m_config.upload_dir, upload.size);
+      m_uploads.push_back(std::move(upload));
+      continue;
+    }
+
+    // fields are small, the body as a whole is at most max_body bytes anyway
+    String value(m_arena);
+    size_t read;
+    do
+    {
+      size_t at = value.size();
+      value.resize(at + 4096);
+      read = reader.read(&value[at], 4096);
+      value.resize(at + read);
+    }
+    while (read > 0);
+
+    m_body_data[String(reader.name(), m_arena)] = std::move(value);
+  }
 }
@@ -1,6 +1,7 @@
 #include <string>
 #include <cstring>
 #include <map>
+#include <sys/uio.h>
 
 #include "server/Response.hpp"
 #include "server/TcpConnection.hpp"
@@ -9,50 +10,148 @@
 #include "error/TodoError.hpp"
 #include "Config.hpp"
 
-Response::Response(Config const& config, TcpConnection& conn) :
+Response::Response(Config const& config, TcpConnection& conn, std::string_view version, bool keep_alive,
+                   bool head_only) :
     m_config(config),
     m_conn(conn),
-    m_headers_sent(false)
+    m_headers_sent(false),
+    m_arena(conn.arena()),
+    m_status_text(m_arena),
+    m_version(version, m_arena),
+    m_keep_alive(keep_alive),
+    m_head_only(head_only),
+    m_headers(m_arena)
 {
     // We want every response to have this header
-    // It tells browsers that we want separate connections per request
-    m_headers["Connection"] = "close";
+    // It tells browsers whether they can send their next request on the same connection
+    set_header("Connection", keep_alive ? "keep-alive" : "close");
+}
+
+bool Response::keeps_alive() const noexcept
+{
+    return m_keep_alive;
+}
+
+void Response::settle_connection(bool raw)
+{
+    if (raw || m_headers.find(std::pmr::string("Content-Length", m_arena)) == m_headers.end())
+    {
+        m_keep_alive = false;
+        set_header("Connection", "close");
+    }
 }
 
 void Response::send(void const* buf, size_t bufsize, bool raw)
 {
-  std::string status = "HTTP/1.0 " + m_status_text + "\r\n";
-  m_conn.puts(status.c_str());
+    // The status line, headers and blank line are gathered into one string so that
+    // together with the body they go out in a single writev()
+    settle_connection(raw);
+    std::pmr::string head = build_head(raw);
+
+    // a raw body carries its own headers, so HEAD keeps it up to the blank line that ends them
+    if (m_head_only && raw)
+    {
+        std::string_view body((char const*) buf, bufsize);
+        size_t end = body.find("\r\n\r\n");
+        if (end != std::string_view::npos) bufsize = end + 4;
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void*) head.data();
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = (void*) buf;
+    iov[1].iov_len = bufsize;
+
+    m_conn.putv(iov, m_head_only && !raw ? 1 : 2);
+    m_headers_sent = true;
+    if (!m_keep_alive) m_conn.shutdown();
+}
+
+void Response::send_prepared(std::string_view prepared, void const* buf, size_t size)
+{
+    // prepared has the Content-Length, so the connection can stay as it is
+    std::pmr::string head = build_head(false, prepared);
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void*) head.data();
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = (void*) buf;
+    iov[1].iov_len = size;
+
+    m_conn.putv(iov, m_head_only ? 1 : 2);
+    m_headers_sent = true;
+    if (!m_keep_alive) m_conn.shutdown();
+}
+
+void Response::send_empty()
+{
+    std::pmr::string head = build_head(false);
+
+    m_conn.puts(head);
+    m_headers_sent = true;
+    if (!m_keep_alive) m_conn.shutdown();
+}
+
+void Response::send_file(int fd, size_t size)
+{
+    settle_connection(false);
+    std::pmr::string head = build_head(false);
 
-  if(raw == false) send_headers();
-  std::string empty_line = "\r\n";
-  m_conn.puts(empty_line.c_str());
-  m_conn.putbuf(buf, bufsize);
-  m_conn.shutdown();
-  //throw TodoError("2", "You need to implement sending responses");
+    // corking keeps the headers from going out in a packet of their own
+    m_conn.cork(true);
+    m_conn.puts(head);
+    m_headers_sent = true;
+    if (!m_head_only) m_conn.sendfile(fd, 0, size);
+    m_conn.cork(false);
+    if (!m_keep_alive) m_conn.shutdown();
 }
 
-void Response::send_headers()
+void Response::send_shared(std::shared_ptr<void const> keep, void const* buf, size_t size)
 {
-  std::string header;
-  for (auto const& element : m_headers)
-  {
-    std::string key = element.first;
-    std::string val = element.second;
-    std::string header = key;
+    settle_connection(false);
+    std::pmr::string head = build_head(false);
 
-    header += ": ";
-    header += val;
-    header += "\r\n";
+    m_conn.cork(true);
+    m_conn.puts(head);
+    m_headers_sent = true;
+    if (!m_head_only) m_conn.putref(std::move(keep), buf, size);
+    m_conn.cork(false);
+    if (!m_keep_alive) m_conn.shutdown();
+}
+
+std::pmr::string Response::build_head(bool raw, std::string_view prepared) const
+{
+    // built up in place, since concatenating would copy to the heap
+    std::pmr::string head(m_arena);
+    head += m_version;
+    head += ' ';
+    head += m_status_text;
+    head += "\r\n";
+
+    if (raw == false)
+    {
+        serialize_headers(head);
+        head += prepared;
+        head += "\r\n";
+    }
 
-    m_conn.puts(header.c_str());
-  }
-  //throw TodoError("2", "You need to implement sending headers");
+    return head;
+}
+
+void Response::serialize_headers(std::pmr::string& out) const
+{
+    for (auto const& element : m_headers)
+    {
+        out += element.first;
+        out += ": ";
+        out += element.second;
+        out += "\r\n";
+    }
 }
 
-void Response::set_header(std::string const& key, std::string const& value)
+void Response::set_header(std::string_view key, std::string_view value)
 {
-  m_headers[key] = value;
+  m_headers.insert_or_assign(std::pmr::string(key, m_arena), value);
   //throw TodoError("2", "You need to implement controllers setting headers");
 }
 
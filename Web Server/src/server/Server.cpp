@@ -2,73 +2,392 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <cstdint>
+#include <cstring>
 #include <cassert>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
 #include <thread>
 #include <vector>
 #include <stdexcept>
+#include <system_error>
 #include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 
 #include "Utils.hpp"
+#include "AllocationCounter.hpp"
 #include "server/TcpConnection.hpp"
 #include "server/Server.hpp"
 #include "server/Request.hpp"
 #include "server/Response.hpp"
+#include "server/TimerWheel.hpp"
+#include "server/MpmcQueue.hpp"
 #include "controller/Controller.hpp"
 #include "controller/SendFileController.hpp"
 #include "controller/TextController.hpp"
 #include "controller/ExecScriptController.hpp"
 #include "http/HttpStatus.hpp"
+#include "http/MimeTypes.hpp"
 #include "error/RequestError.hpp"
 #include "error/ResponseError.hpp"
 #include "error/ControllerError.hpp"
 #include "error/SocketError.hpp"
 #include "error/ConnectionError.hpp"
+#include "error/TimeoutError.hpp"
 #include "error/TodoError.hpp"
+#include "error/ConfigError.hpp"
 
-Server::Server(Config const& config) : m_config(config)
+// Pipelined requests are answered back to back until this much output is queued,
+// then the batch is written out before any more are read
+static size_t const pipeline_batch_bytes = 65536;
+
+/**
+ * An accepted connection on its way through the thread pool's queue, and what each
+ * worker counts about the connections it served. Times are in nanoseconds.
+**/
+struct Server::PoolJob
+{
+    int fd;
+    long queued_ns;
+};
+
+struct Server::PoolStats
+{
+    std::atomic<unsigned long> connections;
+    std::atomic<unsigned long> wait_ns;
+    std::atomic<unsigned long> service_ns;
+
+    PoolStats() : connections(0), wait_ns(0), service_ns(0) { }
+};
+
+static long monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void sem_acquire(sem_t* sem)
+{
+    while (sem_wait(sem) == -1 && errno == EINTR)
+    {
+    }
+}
+
+/**
+ * The acceptor's side of a --handoff worker. in_flight counts the connections handed to the
+ * worker that it has not reported back yet. A worker that reached --max-requests-per-worker
+ * says so in its report and is retiring: it gets no more connections, and once it reported
+ * back every one it had, its channel is closed, which tells it to exit.
+**/
+struct Server::HandoffWorker
+{
+    pid_t pid = -1;
+    int channel = -1;
+    int in_flight = 0;
+    bool retiring = false;
+};
+
+// What a --handoff worker writes back on its channel whenever it is done with a connection
+static char const handoff_done = 'd';
+static char const handoff_retire = 'r';
+
+/**
+ * Passes fd over channel along with a single byte, without blocking.
+**/
+static bool send_fd(int channel, int fd)
+{
+  char byte = 0;
+  struct iovec iov = { &byte, 1 };
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  return sendmsg(channel, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == 1;
+}
+
+/**
+ * Waits for the next fd on channel. Returns -1 once the channel is closed.
+**/
+static int receive_fd(int channel)
+{
+  while (true)
+  {
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    union
+    {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    if (n == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return -1;
+    }
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+      return fd;
+    }
+  }
+}
+
+// The event loops' timer wheel ticks four times a second, and one turn covers about a minute
+static int const timer_tick_ms = 250;
+static size_t const timer_slots = 256;
+
+/**
+ * Where an event loop connection is at, see update_deadline().
+ * pending is how much output was queued when the write deadline was last pushed back.
+**/
+struct Server::Deadline
+{
+    TimerWheel::Timer timer;
+    Phase phase = PHASE_NONE;
+    size_t pending = 0;
+};
+
+/**
+ * What epoll hands back for a connection. The master socket is registered with nullptr instead,
+ * and the ScriptQueue's eventfd with the queue.
+ * A connection that is done while it waits for a script is only closing, and deleted once the
+ * script is, since the script's job still points to it.
+ * It is taken out of epfd by hand: a child forked for a script shares the socket until it execs,
+ * and epoll only forgets a socket once no process has it open anymore.
+**/
+struct Server::EpollConnection
+{
+    TcpConnection* conn;
+    Deadline deadline;
+    int epfd = -1;
+    bool scripting = false;
+    bool closing = false;
+
+    ~EpollConnection()
+    {
+        if (epfd != -1) epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd(), nullptr);
+        TcpConnection::release(conn);
+    }
+};
+
+/**
+ * A script an event loop connection waits for. The script runs on a thread of its own, which
+ * touches nothing else; the rest is for answering the request afterwards. owner is the
+ * EpollConnection or UringConnection.
+**/
+struct Server::ScriptJob
+{
+    std::unique_ptr<ExecScriptController::Script> script;
+    std::string version;
+    bool head_only;
+    void* owner;
+};
+
+/**
+ * Where the threads that run an event loop's scripts leave their jobs. Every job that is added
+ * bumps the eventfd wakeup, which the loop polls; it takes them all out again when it wakes up.
+ * The threads hold on to the queue until they are done, in case the loop is gone by then.
+**/
+struct Server::ScriptQueue : std::enable_shared_from_this<Server::ScriptQueue>
+{
+    int wakeup;
+    std::mutex lock;
+    std::vector<ScriptJob*> done;
+
+    ScriptQueue()
+    {
+        wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wakeup == -1)
+        {
+            throw SocketError("eventfd");
+        }
+    }
+
+    ~ScriptQueue()
+    {
+        for (ScriptJob* job : done)
+        {
+            delete job;
+        }
+        close(wakeup);
+    }
+
+    void push(ScriptJob* job)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            done.push_back(job);
+        }
+        uint64_t one = 1;
+        if (write(wakeup, &one, sizeof(one)) == -1)
+        {
+            d_warnf("Could not wake up the event loop: %s", strerror(errno));
+        }
+    }
+
+    std::vector<ScriptJob*> take()
+    {
+        // cleared first, so a job added in the meantime wakes the loop up again at worst
+        uint64_t count;
+        if (read(wakeup, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        {
+            d_warnf("Could not read the script queue: %s", strerror(errno));
+        }
+
+        std::vector<ScriptJob*> jobs;
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.swap(done);
+        return jobs;
+    }
+};
+
+Server::Server(Config const& config) :
+  m_config(config),
+  m_hello_world(config, "Hello world!\n"),
+  m_scripts(config, "/script"),
+  m_files(config)
+{
+  // loaded before any workers exist, so they only ever read the table
+  if (!MimeTypes::load(m_config.mime_types))
+  {
+    d_warnf("Could not read %s, using the built-in MIME types", m_config.mime_types.c_str());
+  }
+
+  m_master = open_listener(m_config.port);
+  m_listeners.push_back(m_master);
+
+  if (m_config.reuseport)
+  {
+    // the rest of the listeners have to bind to whatever port the first one got
+    struct sockaddr_in bound;
+    socklen_t bound_len = sizeof(bound);
+    if (getsockname(m_master, (struct sockaddr*) &bound, &bound_len) == -1)
+    {
+      throw SocketError("getsockname");
+    }
+
+    int workers = m_config.mode == Config::SM_PREFORK ? m_config.workers : m_config.threads;
+    while ((int) m_listeners.size() < workers)
+    {
+      m_listeners.push_back(open_listener(ntohs(bound.sin_port)));
+    }
+  }
+}
+
+int Server::open_listener(unsigned short port) const
 {
-  //throw TodoError("2", "Server constructor/connecting to a socket");
   // create a master socket
-  m_master = socket(AF_INET, SOCK_STREAM, 0);
+  int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
-  if (m_master == -1)
+  if (listener == -1)
   {
     throw SocketError("scoket");
   }
   // set socket option to allow resuse of address we are about to bind to
   int optval = 1;
-  if (setsockopt(m_master, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int)) == -1)
+  if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int)) == -1)
+  {
+    throw SocketError("setsockopt");
+  }
+  // with SO_REUSEPORT, every worker's listener binds the same port and the kernel
+  // spreads incoming connections across their accept queues
+  if (m_config.reuseport && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int)) == -1)
   {
     throw SocketError("setsockopt");
   }
   // bind the socket to an address
   struct sockaddr_in serverIPAddress;
   serverIPAddress.sin_family      = AF_INET;
-  serverIPAddress.sin_port        = htons(m_config.port);
+  serverIPAddress.sin_port        = htons(port);
   serverIPAddress.sin_addr.s_addr = INADDR_ANY;
   //memset(&serverIPAddress, 0, sizeof(serverIPAddress));
 
-  if (bind(m_master, (struct sockaddr*) &serverIPAddress, sizeof(serverIPAddress)) == -1) {
+  if (bind(listener, (struct sockaddr*) &serverIPAddress, sizeof(serverIPAddress)) == -1) {
     throw SocketError("bind");
   }
   
   // listen for connections on master socket
-  if (listen(m_master, m_config.queue_length) == -1) {
+  if (listen(listener, m_config.queue_length) == -1) {
     throw SocketError("listen");
   }
+
+  return listener;
 }
 
 void Server::run_linear() const
 {
-  while (true)
+  accept_loop(m_master);
+}
+
+void Server::accept_loop(int master, int request_limit) const
+{
+  int served = 0;
+  while (request_limit == 0 || served < request_limit)
   {
     //std::string response;
-    TcpConnection* conn = new TcpConnection(m_config, m_master);
+    TcpConnection* conn;
+    try
+    {
+      conn = TcpConnection::accept(m_config, master);
+    }
+    catch (ConnectionError const& e)
+    {
+      // a failed accept only costs that one connection
+      d_warnf("Could not accept connection: %s", strerror(errno));
+      continue;
+    }
     
     handle(conn);
+    served += conn->request_count();
     
-    delete conn;
+    TcpConnection::release(conn);
   }
 }
 
@@ -76,137 +395,1555 @@ void Server::run_thread_request() const
 {
   while (true)
   {
+    // The free lists are per thread and every thread here serves a single connection before
+    // it exits, taking its list along, so connections are made and deleted outside of them
+    TcpConnection* conn;
+    try
+    {
+      conn = new TcpConnection(m_config, m_master);
+    }
+    catch (ConnectionError const& e)
+    {
+      // a failed accept only costs that one connection
+      d_warnf("Could not accept connection: %s", strerror(errno));
+      continue;
+    }
+
     // create thread to handle requests separately
-    TcpConnection* conn = new TcpConnection(m_config, m_master);
-    std::thread my_thread([this, conn] () -> void {
+    try
+    {
+      std::thread my_thread([this, conn] () -> void {
 	this->handle(conn);
 	delete conn;
       });
-    my_thread.detach();
+      my_thread.detach();
+    }
+    catch (std::system_error const& e)
+    {
+      d_warnf("Could not start a thread for a connection: %s", e.what());
+      delete conn;
+    }
   }
   //throw TodoError("3", "You need to implement thread-per-request mode");
 }
 
 void Server::run_fork() const
 {
+  // Nobody waits for the children that handle connections, so have the kernel reap them
+  // instead of leaving zombies behind. Children put SIGCHLD back the way it was, since
+  // the controllers wait for processes of their own.
+  struct sigaction reap, restore;
+  memset(&reap, 0, sizeof(reap));
+  reap.sa_handler = SIG_DFL;
+  reap.sa_flags = SA_NOCLDWAIT;
+  sigemptyset(&reap.sa_mask);
+  if (sigaction(SIGCHLD, &reap, &restore) == -1)
+  {
+    throw SocketError("sigaction");
+  }
+
   while (true)
   {
     //std::string response;
-    TcpConnection* conn = new TcpConnection(m_config, m_master);
+    TcpConnection* conn;
+    try
+    {
+      conn = TcpConnection::accept(m_config, m_master);
+    }
+    catch (ConnectionError const& e)
+    {
+      d_warnf("Could not accept connection: %s", strerror(errno));
+      continue;
+    }
 
     int ret = fork();
     if (ret == 0)
     {
+      sigaction(SIGCHLD, &restore, NULL);
       handle(conn);
       //delete conn;
       exit(0);
     }
+    else if (ret == -1)
+    {
+      d_warnf("Could not fork for a connection: %s", strerror(errno));
+    }
 
-    delete conn;
+    TcpConnection::release(conn);
   }
   //throw TodoError("3", "You need to implement process-per-request mode");
 }
 
-void Server::run_thread_pool() const
+void Server::run_prefork() const
 {
+  if (m_config.handoff)
+  {
+    run_handoff();
+    return;
+  }
+
+  // with --reuseport worker i always accepts on listener i, including its replacements
+  std::vector<pid_t> workers(m_config.workers);
+  std::vector<long> started(m_config.workers);
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    int listener = m_listeners[i % m_listeners.size()];
+    workers[i] = spawn_worker([this, listener] { accept_loop(listener, m_config.worker_requests); });
+    started[i] = TimerWheel::now_ms();
+  }
+
   while (true)
   {
-    //TcpConnection* conn = new TcpConnection(m_config, m_master);
-    std::vector<std::thread> threads;
-    int n = m_config.threads;
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      throw SocketError("waitpid");
+    }
+
+    size_t i = 0;
+    while (i < workers.size() && workers[i] != pid)
+    {
+      i++;
+    }
+    if (i == workers.size())
+    {
+      continue;
+    }
 
-    // create threads and store them in vector to join them later
-    while (n > 0)
+    // a recycled worker exits cleanly, anything else is worth a warning
+    bool crashed = true;
+    if (WIFSIGNALED(status))
+    {
+      d_warnf("Worker %d was killed by signal %d", pid, WTERMSIG(status));
+    }
+    else if (WEXITSTATUS(status) != 0)
+    {
+      d_warnf("Worker %d exited with status %d", pid, WEXITSTATUS(status));
+    }
+    else
     {
-      threads.push_back(std::thread([this]() {
-	    run_linear();
-	  }));
-      n--;
+      crashed = false;
     }
 
-    // join threads so that parent threaed waits until they are done
-    for (auto& thread: threads)
+    // a worker that can not stay up for a second would otherwise be forked over and over
+    if (crashed && TimerWheel::now_ms() - started[i] < 1000)
     {
-      thread.join();
+      sleep(1);
     }
+
+    int listener = m_listeners[i % m_listeners.size()];
+    workers[i] = spawn_worker([this, listener] { accept_loop(listener, m_config.worker_requests); });
+    started[i] = TimerWheel::now_ms();
   }
-  //throw TodoError("3", "You need to implement thread-pool mode");
-  
 }
 
-void Server::handle(TcpConnection* conn) const
+pid_t Server::spawn_worker(std::function<void()> const& work) const
 {
+  pid_t supervisor = getpid();
+  while (true)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      // go down with the supervisor rather than keep its port
+      if (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1 || getppid() != supervisor)
+      {
+        _exit(1);
+      }
+      work();
+      exit(0);
+    }
+    else if (pid != -1)
+    {
+      return pid;
+    }
 
-    Controller const* controller = nullptr;
+    d_errorf("Could not fork a worker: %s", strerror(errno));
+    sleep(1);
+  }
+}
 
-    try
+void Server::run_handoff() const
+{
+  // retiring workers make room for their replacement right away and finish up on the side
+  std::vector<HandoffWorker> workers(m_config.workers);
+  std::vector<HandoffWorker> retiring;
+  for (HandoffWorker& worker : workers)
+  {
+    spawn_handoff_worker(worker, workers, retiring);
+  }
+
+  std::vector<struct pollfd> fds;
+
+  while (true)
+  {
+    fds.clear();
+    fds.push_back({ m_master, POLLIN, 0 });
+    for (HandoffWorker const& worker : workers)
     {
-        // creating req will parse the incoming request
-        Request req(m_config, *conn);
+      fds.push_back({ worker.channel, POLLIN, 0 });
+    }
+    for (HandoffWorker const& worker : retiring)
+    {
+      fds.push_back({ worker.channel, POLLIN, 0 });
+    }
 
-        // creating res as an empty response
-        Response res(m_config, *conn);
+    if (poll(fds.data(), fds.size(), -1) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      throw SocketError("poll");
+    }
 
-        // Printing the request will be helpful to tell what our server is seeing
-        req.print();
-	
-        std::string path = req.get_path();
+    // go through the reports first, so the connection below goes to whoever is least loaded now
+    for (size_t i = fds.size() - 1; i > 0; i--)
+    {
+      if (fds[i].revents == 0)
+      {
+        continue;
+      }
 
-        // This will route a request to the right controller
-        // You only need to change this if you rename your controllers or add more routes
-        if (path == "/hello-world")
-        {
-            controller = new TextController(m_config, "Hello world!\n");
-        }
-        else if (path.find("/script") == 0)
-        {
-            controller = new ExecScriptController(m_config, "/script");
-        }
-        else
+      bool is_retiring = i > workers.size();
+      HandoffWorker& worker = is_retiring ? retiring[i - 1 - workers.size()] : workers[i - 1];
+
+      char reports[64];
+      ssize_t n = read(worker.channel, reports, sizeof(reports));
+      if (n == -1 && (errno == EAGAIN || errno == EINTR))
+      {
+        continue;
+      }
+
+      bool gone = n <= 0;
+      if (gone)
+      {
+        // the connections still waiting on its channel are closed along with it
+        d_warnf("Worker %d exited with %d connection(s) in flight", worker.pid, worker.in_flight);
+      }
+      for (ssize_t k = 0; k < n; k++)
+      {
+        worker.in_flight--;
+        worker.retiring = worker.retiring || reports[k] == handoff_retire;
+      }
+
+      if (!is_retiring && (gone || worker.retiring))
+      {
+        retiring.push_back(worker);
+        spawn_handoff_worker(worker, workers, retiring);
+        if (gone)
         {
-            controller = new SendFileController(m_config);
+          retiring.back().in_flight = 0;
         }
+      }
+      else if (is_retiring && gone)
+      {
+        worker.in_flight = 0;
+      }
+    }
 
-        // Whatever controller we picked needs to be run with the given request and response
-        controller->run(req, res);
+    for (size_t i = 0; i < retiring.size(); )
+    {
+      if (retiring[i].in_flight > 0)
+      {
+        i++;
+        continue;
+      }
+      // a closed channel is the signal to exit
+      close(retiring[i].channel);
+      waitpid(retiring[i].pid, NULL, 0);
+      retiring.erase(retiring.begin() + i);
     }
-    catch (RequestError const& e)
+
+    if ((fds[0].revents & POLLIN) == 0)
     {
-        d_warnf("Error parsing request: %s", e.what());
-        
-        Controller::send_error_response(m_config, conn, e.status, "Error while parsing request\n");
+      continue;
     }
-    catch (ControllerError const& e)
+
+    int fd = accept4(m_master, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd == -1)
     {
-        d_warnf("Error while handling request: %s", e.what());
+      d_warnf("Could not accept connection: %s", strerror(errno));
+      continue;
+    }
 
-        Controller::send_error_response(m_config, conn, HttpStatus::InternalServerError, "Error while handling request\n");
+    HandoffWorker* target = &workers[0];
+    for (HandoffWorker& worker : workers)
+    {
+      if (worker.in_flight < target->in_flight)
+      {
+        target = &worker;
+      }
     }
-    catch (ResponseError const& e)
+
+    if (send_fd(target->channel, fd))
     {
-        d_warnf("Error while creating response: %s", e.what());
+      target->in_flight++;
+    }
+    else
+    {
+      d_warnf("Could not hand connection to worker %d: %s", target->pid, strerror(errno));
+    }
+    // the worker has its own copy now
+    close(fd);
+  }
+}
 
-        Controller::send_error_response(m_config, conn, HttpStatus::InternalServerError, "Error while handling response\n");
+void Server::spawn_handoff_worker(HandoffWorker& worker, std::vector<HandoffWorker> const& workers,
+                                  std::vector<HandoffWorker> const& retiring) const
+{
+  int channel[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel) == -1)
+  {
+    throw SocketError("socketpair");
+  }
+
+  worker.pid = spawn_worker([this, channel, &workers, &retiring] {
+    // Holding on to the acceptor's end of any channel would keep it from ever reading
+    // as closed, for this worker as well as the others
+    close(channel[0]);
+    for (HandoffWorker const& other : workers)
+    {
+      if (other.channel != -1)
+      {
+        close(other.channel);
+      }
     }
-    catch (ConnectionError const& e)
+    for (HandoffWorker const& other : retiring)
     {
-        // Do not try to write a response when we catch a ConnectionError, because that will likely just throw
-        d_errorf("Connection error: %s", e.what());
+      close(other.channel);
     }
-    catch (TodoError const& e)
+    serve_handoff(channel[1]);
+  });
+
+  close(channel[1]);
+  fcntl(channel[0], F_SETFL, O_NONBLOCK);
+  worker.channel = channel[0];
+  worker.in_flight = 0;
+  worker.retiring = false;
+}
+
+void Server::serve_handoff(int channel) const
+{
+  int served = 0;
+  int fd;
+  while ((fd = receive_fd(channel)) != -1)
+  {
+    try
     {
-        d_errorf("You tried to use unimplemented functionality: %s", e.what());
+      TcpConnection* conn = TcpConnection::acquire(m_config, fd);
+      handle(conn);
+      served += conn->request_count();
+      TcpConnection::release(conn);
+    }
+    catch (ConnectionError const& e)
+    {
+      d_errorf("Connection error: %s", e.what());
+      close(fd);
     }
 
-    // Dont forget about freeing memory!
-    delete controller;
+    // once retiring, keep answering whatever is still on its way until the acceptor hangs up
+    bool retire = m_config.worker_requests > 0 && served >= m_config.worker_requests;
+    char report = retire ? handoff_retire : handoff_done;
+    if (write(channel, &report, 1) != 1)
+    {
+      return;
+    }
+  }
 }
 
-Server::~Server() noexcept
+void Server::run_thread_pool() const
 {
-  if (close(m_master) == -1)
+  if (m_config.reuseport)
+  {
+    run_sharded_pool();
+    return;
+  }
+
+  // Acceptors take a free slot before they accept, so a full queue leaves connections
+  // waiting in the kernel's backlog. Workers take an item before they pop.
+  MpmcQueue<PoolJob> queue(m_config.queue_capacity);
+  sem_t free_slots;
+  sem_t queued;
+  sem_init(&free_slots, 0, queue.capacity());
+  sem_init(&queued, 0, 0);
+
+  std::unique_ptr<PoolStats[]> stats(new PoolStats[m_config.threads]);
+  std::vector<std::thread> threads;
+
+  auto acceptor = [this, &queue, &free_slots, &queued]() {
+    while (true)
+    {
+      sem_acquire(&free_slots);
+
+      PoolJob job;
+      job.fd = accept4(m_master, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+      if (job.fd == -1)
+      {
+        if (errno != EINTR && errno != ECONNABORTED) d_warnf("Could not accept connection: %s", strerror(errno));
+        sem_post(&free_slots);
+        continue;
+      }
+      job.queued_ns = monotonic_ns();
+
+      // a push can only fail while the worker of the last lap is still finishing its pop
+      while (!queue.try_push(job))
+      {
+        std::this_thread::yield();
+      }
+      sem_post(&queued);
+    }
+  };
+
+  // unless it prints stats, the main thread is one of the acceptors
+  int acceptor_threads = m_config.stats_interval > 0 ? m_config.acceptors : m_config.acceptors - 1;
+  for (int i = 0; i < acceptor_threads; i++)
   {
-    d_error("Could not close master socket");
+    threads.push_back(std::thread(acceptor));
+  }
+
+  for (int i = 0; i < m_config.threads; i++)
+  {
+    PoolStats* my_stats = &stats[i];
+    threads.push_back(std::thread([this, &queue, &free_slots, &queued, my_stats]() {
+      while (true)
+      {
+        sem_acquire(&queued);
+
+        // likewise, the job this worker was promised may still be on its way into the queue
+        PoolJob job;
+        while (!queue.try_pop(job))
+        {
+          std::this_thread::yield();
+        }
+        sem_post(&free_slots);
+
+        long start = monotonic_ns();
+        try
+        {
+          TcpConnection* conn = TcpConnection::acquire(m_config, job.fd);
+          handle(conn);
+          TcpConnection::release(conn);
+        }
+        catch (ConnectionError const& e)
+        {
+          d_errorf("Connection error: %s", e.what());
+          close(job.fd);
+        }
+        long end = monotonic_ns();
+
+        my_stats->connections.fetch_add(1, std::memory_order_relaxed);
+        my_stats->wait_ns.fetch_add(start - job.queued_ns, std::memory_order_relaxed);
+        my_stats->service_ns.fetch_add(end - start, std::memory_order_relaxed);
+      }
+    }));
+  }
+
+  if (m_config.stats_interval > 0)
+  {
+    print_pool_stats(stats.get());
+  }
+  else
+  {
+    acceptor();
+  }
+}
+
+void Server::print_pool_stats(PoolStats const* stats) const
+{
+  std::vector<PoolStats> last(m_config.threads);
+
+  while (true)
+  {
+    std::this_thread::sleep_for(std::chrono::seconds(m_config.stats_interval));
+
+    // put together first and written in one go, so request lines from the workers do not end up in between
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+
+    for (int i = 0; i < m_config.threads; i++)
+    {
+      unsigned long connections = stats[i].connections.load(std::memory_order_relaxed);
+      unsigned long wait_ns = stats[i].wait_ns.load(std::memory_order_relaxed);
+      unsigned long service_ns = stats[i].service_ns.load(std::memory_order_relaxed);
+
+      unsigned long count = connections - last[i].connections;
+      if (count > 0)
+      {
+        out << "Worker " << i << ": " << count << " connections, average queue wait "
+            << (wait_ns - last[i].wait_ns) / 1e6 / count << " ms, average service "
+            << (service_ns - last[i].service_ns) / 1e6 / count << " ms\n";
+      }
+      else
+      {
+        out << "Worker " << i << ": idle\n";
+      }
+
+      last[i].connections = connections;
+      last[i].wait_ns = wait_ns;
+      last[i].service_ns = service_ns;
+    }
+
+    FileCache::Stats cache = m_files.cache().stats();
+    out << "File cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions
+        << " evictions, " << cache.invalidations << " invalidations, " << cache.files << " files in "
+        << cache.bytes << " bytes\n";
+
+    std::cout << out.str() << std::flush;
+  }
+}
+
+void Server::run_sharded_pool() const
+{
+  std::vector<int> cpus = available_cpus();
+  std::vector<std::thread> threads;
+
+  // every thread accepts on a listener of its own, pinned to a CPU of its own
+  for (int i = 0; i < m_config.threads; i++)
+  {
+    int listener = m_listeners[i];
+
+    threads.push_back(std::thread([this, listener]() {
+      accept_loop(listener);
+    }));
+
+    pin_worker(threads.back().native_handle(), listener, cpus[i % cpus.size()]);
+  }
+
+  for (auto& thread: threads)
+  {
+    thread.join();
+  }
+}
+
+std::vector<int> Server::available_cpus()
+{
+  std::vector<int> cpus;
+  cpu_set_t set;
+
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+  }
+
+  if (cpus.empty())
+  {
+    cpus.push_back(0);
+  }
+
+  return cpus;
+}
+
+void Server::pin_worker(pthread_t thread, int listener, int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+  {
+    d_warnf("Could not pin worker to CPU %d", cpu);
+  }
+
+  // The reuseport group prefers the listener whose SO_INCOMING_CPU matches the CPU
+  // that took the packet, so connections stay on the core their worker runs on.
+  if (setsockopt(listener, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1)
+  {
+    d_warnf("Could not set SO_INCOMING_CPU on listener %d", listener);
+  }
+}
+
+void Server::run_event_loop() const
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+    {
+        throw SocketError("epoll_create1");
+    }
+
+    int flags = fcntl(m_master, F_GETFL);
+    if (flags == -1 || fcntl(m_master, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        throw SocketError("fcntl");
+    }
+
+    // the master socket is the only entry without a connection attached
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, m_master, &ev) == -1)
+    {
+        throw SocketError("epoll_ctl");
+    }
+
+    std::shared_ptr<ScriptQueue> scripts = std::make_shared<ScriptQueue>();
+    ev.data.ptr = scripts.get();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, scripts->wakeup, &ev) == -1)
+    {
+        throw SocketError("epoll_ctl");
+    }
+
+    int const max_events = 256;
+    struct epoll_event events[max_events];
+
+    TimerWheel wheel(timer_tick_ms, timer_slots);
+    std::vector<TimerWheel::Timer*> expired;
+
+    while (true)
+    {
+        int n = epoll_wait(epfd, events, max_events, wheel.next_timeout_ms());
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            throw SocketError("epoll_wait");
+        }
+
+        // finished scripts are only answered after the batch, since that can delete connections
+        // that are further down in events
+        bool scripts_done = false;
+        for (int i = 0; i < n; i++)
+        {
+            EpollConnection* ec = (EpollConnection*) events[i].data.ptr;
+
+            if (ec == nullptr)
+            {
+                accept_ready(epfd, wheel);
+            }
+            else if (events[i].data.ptr == scripts.get())
+            {
+                scripts_done = true;
+            }
+            else if (ec->closing)
+            {
+                // nothing left to do until its script is done
+            }
+            else if (!on_ready(ec, events[i].events, *scripts))
+            {
+                ec->closing = true;
+                ec->deadline.timer.cancel();
+                if (!ec->scripting) delete ec;
+            }
+            else
+            {
+                update_deadline(wheel, ec->deadline, ec->conn, ec->scripting);
+            }
+        }
+
+        if (scripts_done)
+        {
+            scripts_ready(*scripts, wheel);
+        }
+
+        wheel.expire(expired);
+        for (TimerWheel::Timer* timer : expired)
+        {
+            // connections that wait for a script have no deadline
+            EpollConnection* ec = (EpollConnection*) timer->data;
+            d_warnf("Connection %d timed out", ec->conn->fd());
+            delete ec;
+        }
+        expired.clear();
+    }
+}
+
+void Server::accept_ready(int epfd, TimerWheel& wheel) const
+{
+    while (true)
+    {
+        int fd = accept4(m_master, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) d_warnf("Could not accept connection: %s", strerror(errno));
+            return;
+        }
+
+        TcpConnection* conn;
+        try
+        {
+            conn = TcpConnection::acquire(m_config, fd);
+        }
+        catch (ConnectionError const& e)
+        {
+            d_errorf("Connection error: %s", e.what());
+            close(fd);
+            continue;
+        }
+
+        EpollConnection* ec = new EpollConnection();
+        ec->conn = conn;
+        ec->deadline.timer.data = ec;
+
+        try
+        {
+            ec->conn->set_nonblocking();
+            ec->conn->batch(true);
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = ec;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+            {
+                throw ConnectionError("epoll_ctl");
+            }
+            ec->epfd = epfd;
+
+            update_deadline(wheel, ec->deadline, ec->conn);
+        }
+        catch (ConnectionError const& e)
+        {
+            d_errorf("Connection error: %s", e.what());
+            delete ec;
+        }
+    }
+}
+
+bool Server::on_ready(EpollConnection* ec, unsigned int events, ScriptQueue& scripts) const
+{
+    TcpConnection* conn = ec->conn;
+    if (events & EPOLLERR)
+    {
+        return false;
+    }
+
+    try
+    {
+        bool readable = events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP);
+        bool eof = false;
+
+        if (conn->pending_output())
+        {
+            conn->flush();
+        }
+
+        while (true)
+        {
+            if (!conn->is_shutdown() && (readable || conn->receive_stalled()))
+            {
+                eof = !conn->receive();
+                readable = false;
+            }
+
+            // Answer every complete request in the buffer and write the responses out together.
+            // If they have to wait for the socket, the rest wait behind them until flush() catches up,
+            // and if one of them is for a script, the rest wait until scripts_ready() answers it.
+            while (!ec->scripting && !conn->pending_output() && !conn->is_shutdown()
+                   && Request::buffered_length(m_config, *conn) > 0)
+            {
+                ec->scripting = serve_buffered(conn, scripts, ec);
+                conn->flush();
+            }
+
+            if (eof || ec->scripting || !conn->receive_stalled() || conn->pending_output() || conn->is_shutdown())
+            {
+                break;
+            }
+        }
+
+        // the client still gets the response of a script it is waiting for, which closes the connection
+        if (eof && !conn->is_shutdown() && !ec->scripting)
+        {
+            conn->shutdown();
+        }
+
+        // a shut down connection only sticks around until its last response is flushed
+        return !conn->is_shutdown() || conn->pending_output();
+    }
+    catch (ConnectionError const& e)
+    {
+        d_errorf("Connection error: %s", e.what());
+        return false;
+    }
+}
+
+void Server::scripts_ready(ScriptQueue& scripts, TimerWheel& wheel) const
+{
+    for (ScriptJob* job : scripts.take())
+    {
+        EpollConnection* ec = (EpollConnection*) job->owner;
+        ec->scripting = false;
+        if (!ec->closing)
+        {
+            answer_script(ec->conn, *job);
+        }
+        delete job;
+
+        if (ec->closing || !on_ready(ec, 0, scripts))
+        {
+            delete ec;
+        }
+        else
+        {
+            update_deadline(wheel, ec->deadline, ec->conn, ec->scripting);
+        }
+    }
+}
+
+Server::Phase Server::phase_of(TcpConnection* conn) noexcept
+{
+    if (conn->pending_output())
+    {
+        return PHASE_WRITE;
+    }
+    if (conn->is_shutdown())
+    {
+        return PHASE_NONE;
+    }
+    if (conn->buffered_size() > 0)
+    {
+        return Request::head_buffered(*conn) ? PHASE_BODY : PHASE_HEADER;
+    }
+
+    // the first request gets the header timeout from the moment the connection is accepted
+    return conn->request_count() == 0 ? PHASE_HEADER : PHASE_IDLE;
+}
+
+void Server::update_deadline(TimerWheel& wheel, Deadline& deadline, TcpConnection* conn, bool scripting) const
+{
+    Phase phase = scripting ? PHASE_NONE : phase_of(conn);
+    size_t pending = conn->pending_bytes();
+
+    // staying in a phase keeps its deadline, except that writes get more time as long as the client keeps reading
+    bool progress = phase == PHASE_WRITE && pending < deadline.pending;
+    deadline.pending = pending;
+    if (phase == deadline.phase && !progress)
+    {
+        return;
+    }
+    deadline.phase = phase;
+
+    int seconds;
+    switch (phase)
+    {
+    case PHASE_HEADER:
+        seconds = m_config.header_timeout;
+        break;
+    case PHASE_BODY:
+        seconds = m_config.body_timeout;
+        break;
+    case PHASE_WRITE:
+        seconds = m_config.write_timeout;
+        break;
+    case PHASE_IDLE:
+        seconds = m_config.keep_alive_timeout;
+        break;
+    default:
+        deadline.timer.cancel();
+        return;
+    }
+
+    wheel.schedule(deadline.timer, seconds * 1000);
+}
+
+// user_data of every io_uring submission is the UringConnection it belongs to,
+// with the kind of operation in the low bits
+enum UringOp { URING_ACCEPT = 1, URING_RECV, URING_SEND, URING_FILES_UPDATE, URING_READ, URING_SEND_CHUNK, URING_TIMEOUT,
+               URING_SCRIPTS };
+static uint64_t const uring_op_mask = 15;
+
+static unsigned const uring_entries = 1024;
+static unsigned const uring_file_slots = 4096;
+static unsigned const uring_buffers = 1024;
+static unsigned const uring_buffer_size = 4096;
+static size_t const uring_chunk_size = 65536;
+static size_t const uring_max_buffered = 1 << 20;
+
+/**
+ * Everything the io_uring loop tracks about a connection besides the TcpConnection itself.
+ * File bodies are read one chunk at a time into chunk through a registered file slot,
+ * and each chunk is sent before the next one is read. Aligned so that the low bits of its
+ * address are free for the UringOp.
+**/
+struct alignas(16) Server::UringConnection
+{
+    TcpConnection* conn;
+    int slot;
+    int file_fd;
+    bool slot_current;
+    bool recv_armed;
+    bool closing;
+    bool failed;
+    bool scripting;
+    int inflight;
+    std::vector<char> chunk;
+    size_t chunk_len;
+    size_t chunk_sent;
+    Deadline deadline;
+};
+
+static uint64_t uring_data(void* ptr, UringOp op)
+{
+    return (uint64_t) (uintptr_t) ptr | op;
+}
+
+void Server::run_io_uring() const
+{
+    IoUring ring(uring_entries);
+    ring.register_file_slots(uring_file_slots);
+    ring.provide_buffers(uring_buffers, uring_buffer_size);
+
+    std::vector<int> free_slots;
+    for (int slot = uring_file_slots - 1; slot >= 0; slot--)
+    {
+        free_slots.push_back(slot);
+    }
+
+    std::shared_ptr<ScriptQueue> scripts = std::make_shared<ScriptQueue>();
+
+    uring_arm_accept(ring);
+    uring_arm_scripts(ring, *scripts);
+
+    TimerWheel wheel(timer_tick_ms, timer_slots);
+    std::vector<TimerWheel::Timer*> expired;
+
+    // a timeout completion wakes the loop up for the wheel's next tick; the kernel copies ts on submission
+    bool timeout_armed = false;
+    struct __kernel_timespec ts;
+
+    while (true)
+    {
+        int wait = wheel.next_timeout_ms();
+        if (!timeout_armed && wait >= 0)
+        {
+            ts.tv_sec = wait / 1000;
+            ts.tv_nsec = (wait % 1000) * 1000000L;
+
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uintptr_t) &ts;
+            sqe->len = 1;
+            sqe->user_data = uring_data(nullptr, URING_TIMEOUT);
+            timeout_armed = true;
+        }
+
+        ring.submit_and_wait();
+
+        struct io_uring_cqe* cqe;
+        while ((cqe = ring.peek_cqe()) != nullptr)
+        {
+            struct io_uring_cqe done = *cqe;
+            ring.cqe_seen();
+
+            if ((done.user_data & uring_op_mask) == URING_TIMEOUT)
+            {
+                timeout_armed = false;
+                continue;
+            }
+            if ((done.user_data & uring_op_mask) == URING_SCRIPTS)
+            {
+                uring_scripts_done(ring, free_slots, wheel, *scripts);
+                uring_arm_scripts(ring, *scripts);
+                continue;
+            }
+            uring_complete(ring, &done, free_slots, wheel, *scripts);
+        }
+
+        wheel.expire(expired);
+        for (TimerWheel::Timer* timer : expired)
+        {
+            uring_expire(ring, (UringConnection*) timer->data, free_slots, *scripts);
+        }
+        expired.clear();
+    }
+}
+
+void Server::uring_arm_accept(IoUring& ring) const
+{
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_master;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+    sqe->user_data = uring_data(nullptr, URING_ACCEPT);
+}
+
+void Server::uring_arm_recv(IoUring& ring, UringConnection* uc) const
+{
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uc->conn->fd();
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IoUring::buf_group;
+    sqe->user_data = uring_data(uc, URING_RECV);
+
+    uc->recv_armed = true;
+}
+
+void Server::uring_arm_scripts(IoUring& ring, ScriptQueue& scripts) const
+{
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = scripts.wakeup;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = uring_data(nullptr, URING_SCRIPTS);
+}
+
+void Server::uring_scripts_done(IoUring& ring, std::vector<int>& free_slots, TimerWheel& wheel, ScriptQueue& scripts) const
+{
+    for (ScriptJob* job : scripts.take())
+    {
+        UringConnection* uc = (UringConnection*) job->owner;
+        uc->scripting = false;
+        if (!uc->closing && !uc->failed)
+        {
+            answer_script(uc->conn, *job);
+        }
+        delete job;
+
+        uring_write(ring, uc, scripts);
+        uring_settle(ring, uc, free_slots, wheel);
+    }
+}
+
+void Server::uring_complete(IoUring& ring, struct io_uring_cqe const* cqe, std::vector<int>& free_slots, TimerWheel& wheel,
+                            ScriptQueue& scripts) const
+{
+    UringOp op = (UringOp) (cqe->user_data & uring_op_mask);
+    UringConnection* uc = (UringConnection*) (uintptr_t) (cqe->user_data & ~uring_op_mask);
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (op == URING_ACCEPT)
+    {
+        if (cqe->res >= 0)
+        {
+            TcpConnection* conn = nullptr;
+            try
+            {
+                conn = TcpConnection::acquire(m_config, cqe->res);
+                conn->set_deferred();
+            }
+            catch (ConnectionError const& e)
+            {
+                d_errorf("Connection error: %s", e.what());
+                if (conn == nullptr)
+                {
+                    close(cqe->res);
+                }
+                TcpConnection::release(conn);
+                conn = nullptr;
+            }
+
+            if (conn != nullptr)
+            {
+                uc = new UringConnection();
+                uc->conn = conn;
+                uc->slot = -1;
+                uc->file_fd = -1;
+                uc->deadline.timer.data = uc;
+                if (!free_slots.empty())
+                {
+                    uc->slot = free_slots.back();
+                    free_slots.pop_back();
+                }
+                uring_arm_recv(ring, uc);
+                update_deadline(wheel, uc->deadline, conn);
+            }
+        }
+        else if (cqe->res == -EINVAL)
+        {
+            throw ConfigError("io_uring on this kernel has no multishot accept (need Linux 5.19 or newer)");
+        }
+        else
+        {
+            d_warnf("Could not accept connection: %s", strerror(-cqe->res));
+        }
+
+        if (!more) uring_arm_accept(ring);
+        return;
+    }
+
+    // clearing a slot of a connection that is already gone
+    if (uc == nullptr)
+    {
+        return;
+    }
+
+    if (op == URING_RECV)
+    {
+        if (!more) uc->recv_armed = false;
+
+        if (cqe->res > 0)
+        {
+            unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            uc->conn->append_received(ring.buffer(bid), cqe->res);
+            ring.recycle_buffer(bid);
+
+            if (uc->conn->buffered_size() > uring_max_buffered)
+            {
+                uc->failed = true;
+            }
+            else if (!uc->closing && !uc->scripting)
+            {
+                uc->scripting = serve_buffered(uc->conn, scripts, uc);
+            }
+        }
+        else if (cqe->res == 0)
+        {
+            // the client is done sending; answer what it already sent and close, which the
+            // response of a script it is waiting for does anyway
+            if (!uc->conn->is_shutdown() && !uc->scripting) uc->conn->shutdown();
+        }
+        else if (cqe->res != -ENOBUFS)
+        {
+            uc->failed = true;
+        }
+
+        // -ENOBUFS just means every provided buffer was busy, so try again
+        if (!uc->recv_armed && !uc->closing && !uc->failed && !uc->conn->is_shutdown() && cqe->res != 0)
+        {
+            uring_arm_recv(ring, uc);
+        }
+    }
+    else
+    {
+        uc->inflight--;
+
+        if (cqe->res < 0 && cqe->res != -ECANCELED)
+        {
+            uc->failed = true;
+        }
+        else if (op == URING_SEND && cqe->res > 0)
+        {
+            uc->conn->next_pending()->offset += cqe->res;
+        }
+        else if (op == URING_FILES_UPDATE)
+        {
+            uc->slot_current = cqe->res >= 0;
+        }
+        else if (op == URING_READ)
+        {
+            if (cqe->res == 0) uc->failed = true;
+            if (cqe->res > 0) uc->chunk_len = cqe->res;
+        }
+        else if (op == URING_SEND_CHUNK && cqe->res > 0)
+        {
+            uc->chunk_sent += cqe->res;
+        }
+    }
+
+    uring_write(ring, uc, scripts);
+    uring_settle(ring, uc, free_slots, wheel);
+}
+
+void Server::uring_settle(IoUring& ring, UringConnection* uc, std::vector<int>& free_slots, TimerWheel& wheel) const
+{
+    if (uc->closing && !uc->recv_armed && uc->inflight == 0 && !uc->scripting)
+    {
+        uring_close(ring, uc, free_slots);
+    }
+    else if (uc->closing)
+    {
+        // all that is left is waiting for the ring and the script to let go of it
+        uc->deadline.timer.cancel();
+    }
+    else
+    {
+        update_deadline(wheel, uc->deadline, uc->conn, uc->scripting);
+    }
+}
+
+void Server::uring_expire(IoUring& ring, UringConnection* uc, std::vector<int>& free_slots, ScriptQueue& scripts) const
+{
+    d_warnf("Connection %d timed out", uc->conn->fd());
+
+    // shutting the socket down fails whatever is still waiting on the client
+    uc->failed = true;
+    ::shutdown(uc->conn->fd(), SHUT_RDWR);
+    uring_write(ring, uc, scripts);
+
+    if (uc->closing && !uc->recv_armed && uc->inflight == 0 && !uc->scripting)
+    {
+        uring_close(ring, uc, free_slots);
+    }
+}
+
+void Server::uring_write(IoUring& ring, UringConnection* uc, ScriptQueue& scripts) const
+{
+    if (uc->inflight > 0 || uc->closing)
+    {
+        return;
+    }
+
+    if (uc->failed)
+    {
+        // the socket is shut down by hand so that the armed receive completes
+        uc->closing = true;
+        ::shutdown(uc->conn->fd(), SHUT_RDWR);
+        return;
+    }
+
+    TcpConnection::PendingWrite* pending = uc->conn->next_pending();
+
+    // retire whatever the completed operations finished off
+    if (pending != nullptr && pending->fd != -1 && uc->chunk_len > 0 && uc->chunk_sent == uc->chunk_len)
+    {
+        pending->offset += uc->chunk_len;
+        pending->count -= uc->chunk_len;
+        uc->chunk_len = uc->chunk_sent = 0;
+    }
+    if (pending != nullptr && ((pending->fd == -1 && (size_t) pending->offset == pending->bytes().size())
+                               || (pending->fd != -1 && pending->count == 0)))
+    {
+        if (pending->fd != -1) uc->slot_current = false;
+        uc->conn->pop_pending();
+        pending = uc->conn->next_pending();
+    }
+
+    if (pending == nullptr)
+    {
+        if (uc->conn->is_shutdown())
+        {
+            // carries out the shutdown() that was waiting on the queue, which ends the receive
+            uc->conn->flush();
+            uc->closing = true;
+        }
+        else if (!uc->scripting && Request::buffered_length(m_config, *uc->conn) > 0)
+        {
+            uc->scripting = serve_buffered(uc->conn, scripts, uc);
+            uring_write(ring, uc, scripts);
+        }
+        return;
+    }
+
+    int sock = uc->conn->fd();
+
+    if (pending->fd == -1)
+    {
+        struct io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = sock;
+        std::string_view bytes = pending->bytes();
+        sqe->addr = (uintptr_t) (bytes.data() + pending->offset);
+        sqe->len = bytes.size() - pending->offset;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = uring_data(uc, URING_SEND);
+        uc->inflight++;
+        return;
+    }
+
+    // a short read cuts the chain, in which case the rest of the chunk is sent from here
+    if (uc->chunk_len > 0)
+    {
+        struct io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = sock;
+        sqe->addr = (uintptr_t) (uc->chunk.data() + uc->chunk_sent);
+        sqe->len = uc->chunk_len - uc->chunk_sent;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = uring_data(uc, URING_SEND_CHUNK);
+        uc->inflight++;
+        return;
+    }
+
+    size_t len = std::min(pending->count, uring_chunk_size);
+    uc->chunk.resize(uring_chunk_size);
+
+    if (uc->slot != -1 && !uc->slot_current)
+    {
+        uc->file_fd = pending->fd;
+
+        struct io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_FILES_UPDATE;
+        sqe->fd = -1;
+        sqe->addr = (uintptr_t) &uc->file_fd;
+        sqe->len = 1;
+        sqe->off = uc->slot;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = uring_data(uc, URING_FILES_UPDATE);
+        uc->inflight++;
+        uc->slot_current = true;
+    }
+
+    struct io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    if (uc->slot != -1)
+    {
+        sqe->fd = uc->slot;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    }
+    else
+    {
+        sqe->fd = pending->fd;
+        sqe->flags = IOSQE_IO_LINK;
+    }
+    sqe->addr = (uintptr_t) uc->chunk.data();
+    sqe->len = len;
+    sqe->off = pending->offset;
+    sqe->user_data = uring_data(uc, URING_READ);
+    uc->inflight++;
+
+    sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sock;
+    sqe->addr = (uintptr_t) uc->chunk.data();
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = uring_data(uc, URING_SEND_CHUNK);
+    uc->inflight++;
+}
+
+void Server::uring_close(IoUring& ring, UringConnection* uc, std::vector<int>& free_slots) const
+{
+    if (uc->slot != -1)
+    {
+        if (uc->slot_current)
+        {
+            // drop the slot's reference to the last file served
+            static int const no_file = -1;
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_FILES_UPDATE;
+            sqe->fd = -1;
+            sqe->addr = (uintptr_t) &no_file;
+            sqe->len = 1;
+            sqe->off = uc->slot;
+            sqe->user_data = uring_data(nullptr, URING_FILES_UPDATE);
+        }
+        free_slots.push_back(uc->slot);
+    }
+
+    TcpConnection::release(uc->conn);
+    delete uc;
+}
+
+void Server::handle(TcpConnection* conn) const
+{
+    int idle_ms = m_config.keep_alive_timeout * 1000;
+
+    // responses are queued and only written once no further request is waiting
+    conn->batch(true);
+
+    try
+    {
+        // serve requests until one of them ends the connection or the client goes quiet for too long
+        while (true)
+        {
+            bool keep_alive = handle_request(conn);
+
+            if (keep_alive && conn->pending_bytes() < pipeline_batch_bytes
+                && Request::buffered_length(m_config, *conn) > 0)
+            {
+                continue;
+            }
+
+            conn->flush();
+
+            unsigned char c;
+            if (!keep_alive)
+            {
+                break;
+            }
+            if (!conn->wait_readable(idle_ms) || !conn->peek(&c))
+            {
+                conn->shutdown();
+                break;
+            }
+        }
+    }
+    catch (TimeoutError const& e)
+    {
+        d_warnf("Closing connection: %s", e.what());
+    }
+    catch (ConnectionError const& e)
+    {
+        d_errorf("Connection error: %s", e.what());
+    }
+}
+
+bool Server::serve_buffered(TcpConnection* conn, ScriptQueue& scripts, void* owner) const
+{
+    // a new batch only starts once the last one has been written out
+    if (conn->pending_output())
+    {
+        return false;
+    }
+
+    while (!conn->is_shutdown() && conn->pending_bytes() < pipeline_batch_bytes
+           && Request::buffered_length(m_config, *conn) > 0)
+    {
+        size_t before = conn->buffered_size();
+        ScriptJob* job = nullptr;
+        bool keep_alive = handle_request(conn, &job);
+
+        if (job != nullptr)
+        {
+            job->owner = owner;
+            start_script(scripts, job);
+            return true;
+        }
+
+        // the request could not be parsed without more input, which should never happen
+        if ((!keep_alive || conn->buffered_size() == before) && !conn->is_shutdown())
+        {
+            conn->shutdown();
+        }
+    }
+    return false;
+}
+
+void Server::start_script(ScriptQueue& scripts, ScriptJob* job) const
+{
+    std::shared_ptr<ScriptQueue> queue = scripts.shared_from_this();
+    try
+    {
+        std::thread([this, queue, job]
+        {
+            m_scripts.execute(*job->script);
+            queue->push(job);
+        }).detach();
+    }
+    catch (std::system_error const& e)
+    {
+        // the loop has to wait for this one, but the client still gets its answer
+        d_warnf("Could not start a thread for a script: %s", e.what());
+        m_scripts.execute(*job->script);
+        queue->push(job);
+    }
+}
+
+void Server::answer_script(TcpConnection* conn, ScriptJob const& job) const
+{
+    // like any response a script writes, this one closes the connection
+    try
+    {
+        Response res(m_config, *conn, job.version, false, job.head_only);
+        m_scripts.respond(*job.script, res);
+    }
+    catch (ResponseError const& e)
+    {
+        d_warnf("Error while creating response: %s", e.what());
+        conn->shutdown();
+    }
+    catch (ConnectionError const& e)
+    {
+        d_errorf("Connection error: %s", e.what());
+        conn->shutdown();
+    }
+
+    conn->reset_arena();
+}
+
+bool Server::handle_request(TcpConnection* conn, ScriptJob** deferred) const
+{
+
+    Controller const* controller;
+    bool keep_alive = false;
+    unsigned long allocated = allocations();
+
+    try
+    {
+        // creating req will parse the incoming request
+        Request req(m_config, *conn);
+
+        // creating res as an empty response, which closes the connection unless both
+        // the client and the per-connection request limit allow another request.
+        // HEAD requests get everything a GET would except for the body
+        bool reusable = conn->count_request() < m_config.max_requests && req.keep_alive();
+        Response res(m_config, *conn, req.get_version(), reusable, req.get_method() == "HEAD");
+
+        // Printing the request will be helpful to tell what our server is seeing
+        req.print();
+	
+        Request::String const& path = req.get_path();
+
+        // This will route a request to the right controller
+        // You only need to change this if you rename your controllers or add more routes
+        if (path == "/hello-world")
+        {
+            controller = &m_hello_world;
+        }
+        else if (path.find("/script") == 0)
+        {
+            controller = &m_scripts;
+        }
+        else
+        {
+            controller = &m_files;
+        }
+
+        // Whatever controller we picked needs to be run with the given request and response,
+        // except that a script for an event loop is only prepared, see ScriptJob
+        std::unique_ptr<ExecScriptController::Script> script;
+        if (controller == &m_scripts && deferred != nullptr)
+        {
+            script = m_scripts.prepare(req, res);
+        }
+        else
+        {
+            controller->run(req, res);
+        }
+
+        // whatever the controller left of the body has to go before the next request can be read
+        keep_alive = res.keeps_alive() && req.discard_body();
+
+        if (script != nullptr)
+        {
+            *deferred = new ScriptJob{ std::move(script), std::string(req.get_version()), req.get_method() == "HEAD", nullptr };
+        }
+    }
+    catch (RequestError const& e)
+    {
+        d_warnf("Error parsing request: %s", e.what());
+        
+        Controller::send_error_response(m_config, conn, e.status, "Error while parsing request\n");
+    }
+    catch (ControllerError const& e)
+    {
+        d_warnf("Error while handling request: %s", e.what());
+
+        Controller::send_error_response(m_config, conn, HttpStatus::InternalServerError, "Error while handling request\n");
+    }
+    catch (ResponseError const& e)
+    {
+        d_warnf("Error while creating response: %s", e.what());
+
+        Controller::send_error_response(m_config, conn, HttpStatus::InternalServerError, "Error while handling response\n");
+    }
+    catch (TimeoutError const& e)
+    {
+        // the client is too slow to be worth an answer
+        d_warnf("Closing connection: %s", e.what());
+    }
+    catch (ConnectionError const& e)
+    {
+        // Do not try to write a response when we catch a ConnectionError, because that will likely just throw
+        d_errorf("Connection error: %s", e.what());
+    }
+    catch (TodoError const& e)
+    {
+        d_errorf("You tried to use unimplemented functionality: %s", e.what());
+    }
+
+    // req and res are gone, and with them everything they allocated
+    conn->reset_arena();
+    conn->reset_body();
+
+    if (counting_allocations)
+    {
+        d_printf("Request took %lu allocations", allocations() - allocated);
+    }
+
+    return keep_alive;
+}
+
+Server::~Server() noexcept
+{
+  // m_master is m_listeners[0]
+  for (int listener : m_listeners)
+  {
+    if (close(listener) == -1)
+    {
+      d_error("Could not close master socket");
+    }
   }
 
 }
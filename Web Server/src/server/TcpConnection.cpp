@@ -2,12 +2,24 @@
 #include <iostream>
 #include <unistd.h>
 #include <cstring>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <climits>
 
 #include "Utils.hpp"
 #include "Config.hpp"
 #include "server/TcpConnection.hpp"
+#include "server/TimerWheel.hpp"
 #include "error/ConnectionError.hpp"
+#include "error/TimeoutError.hpp"
 #include "error/SocketError.hpp"
 #include "error/TodoError.hpp"
 
@@ -15,9 +27,23 @@ TcpConnection::TcpConnection(Config const& config, int master_fd) :
     m_config(config),
     m_master(master_fd),
     //m_conn(accept(m_master, NULL, NULL)),
-    m_shutdown(false)
+    m_shutdown(false),
+    m_rbuf(m_rbuf_size),
+    m_rpos(0),
+    m_rend(0),
+    m_nonblocking(false),
+    m_deferred(false),
+    m_shutdown_pending(false),
+    m_receive_stalled(false),
+    m_batching(false),
+    m_requests(0),
+    m_read_deadline(-1),
+    m_arena_buffer(new char[m_arena_size]),
+    m_arena(m_arena_buffer.get(), m_arena_size),
+    m_spool(m_spool_memory)
 {
-  m_conn = accept(m_master, NULL, NULL);
+  // the socket never blocks in the kernel, so that waits can be given a timeout with poll()
+  m_conn = accept4(m_master, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
   if (m_conn == -1)
   {
     throw ConnectionError("accept");
@@ -25,43 +51,860 @@ TcpConnection::TcpConnection(Config const& config, int master_fd) :
   //throw TodoError("2", "You need to implement construction of TcpConnections");
 }
 
+TcpConnection::TcpConnection(Config const& config, int conn_fd, Adopt) :
+    m_config(config),
+    m_master(-1),
+    m_conn(conn_fd),
+    m_shutdown(false),
+    m_rbuf(m_rbuf_size),
+    m_rpos(0),
+    m_rend(0),
+    m_nonblocking(false),
+    m_deferred(false),
+    m_shutdown_pending(false),
+    m_receive_stalled(false),
+    m_batching(false),
+    m_requests(0),
+    m_read_deadline(-1),
+    m_arena_buffer(new char[m_arena_size]),
+    m_arena(m_arena_buffer.get(), m_arena_size),
+    m_spool(m_spool_memory)
+{
+    int flags = fcntl(m_conn, F_GETFL);
+    if (flags == -1 || ((flags & O_NONBLOCK) == 0 && fcntl(m_conn, F_SETFL, flags | O_NONBLOCK) == -1))
+    {
+        throw ConnectionError("fcntl");
+    }
+}
+
 TcpConnection::~TcpConnection() noexcept
 {
+    close_socket();
+}
+
+/**
+ * The connections a thread has released, waiting for its next acquire().
+ * Anything past free_list_max is deleted instead, so a burst does not stay allocated.
+**/
+static size_t const free_list_max = 64;
+
+struct FreeList
+{
+    std::vector<TcpConnection*> conns;
+
+    ~FreeList()
+    {
+        for (TcpConnection* conn : conns)
+        {
+            delete conn;
+        }
+    }
+};
+
+static thread_local FreeList free_list;
+
+TcpConnection* TcpConnection::acquire(Config const& config, int conn_fd)
+{
+    if (free_list.conns.empty())
+    {
+        return new TcpConnection(config, conn_fd, Adopt());
+    }
+
+    TcpConnection* conn = free_list.conns.back();
+    free_list.conns.pop_back();
+    try
+    {
+        conn->reset(conn_fd);
+    }
+    catch (ConnectionError const& e)
+    {
+        free_list.conns.push_back(conn);
+        throw;
+    }
+    return conn;
+}
+
+TcpConnection* TcpConnection::accept(Config const& config, int master_fd)
+{
+    // the socket never blocks in the kernel, so that waits can be given a timeout with poll()
+    int conn_fd = accept4(master_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (conn_fd == -1)
+    {
+        throw ConnectionError("accept");
+    }
+
+    try
+    {
+        return acquire(config, conn_fd);
+    }
+    catch (ConnectionError const& e)
+    {
+        close(conn_fd);
+        throw;
+    }
+}
+
+void TcpConnection::release(TcpConnection* conn) noexcept
+{
+    if (conn == nullptr)
+    {
+        return;
+    }
+
+    if (free_list.conns.size() >= free_list_max)
+    {
+        delete conn;
+        return;
+    }
+
+    conn->close_socket();
+    free_list.conns.push_back(conn);
+}
+
+void TcpConnection::reset(int conn_fd)
+{
+    m_master = -1;
+    m_conn = conn_fd;
+    m_shutdown = false;
+    m_rpos = 0;
+    m_rend = 0;
+    m_nonblocking = false;
+    m_deferred = false;
+    m_shutdown_pending = false;
+    m_receive_stalled = false;
+    m_batching = false;
+    m_requests = 0;
+    m_read_deadline = -1;
+    m_arena.release();
+    m_parser.reset();
+    reset_body();
+
+    // a buffer that had to grow for one client goes back to its usual size
+    if (m_rbuf.size() > m_rbuf_size)
+    {
+        m_rbuf.resize(m_rbuf_size);
+        m_rbuf.shrink_to_fit();
+    }
+
+    int flags = fcntl(m_conn, F_GETFL);
+    if (flags == -1 || ((flags & O_NONBLOCK) == 0 && fcntl(m_conn, F_SETFL, flags | O_NONBLOCK) == -1))
+    {
+        m_conn = -1;
+        throw ConnectionError("fcntl");
+    }
+}
+
+void TcpConnection::close_socket() noexcept
+{
+    if (m_conn == -1)
+    {
+        return;
+    }
+
     d_printf("Closing connection on %d", m_conn);
 
+    for (auto const& pending : m_wqueue)
+    {
+        if (pending.fd != -1) close(pending.fd);
+    }
+    m_wqueue.clear();
+
     if (close(m_conn) == -1) d_errorf("Could not close connection %d", m_conn);
+    m_conn = -1;
 }
 
 void TcpConnection::shutdown()
 {
+    m_shutdown = true;
+
+    if (!m_wqueue.empty())
+    {
+        m_shutdown_pending = true;
+        return;
+    }
+
     d_printf("Shutting down connection on %d", m_conn);
     
     if (::shutdown(m_conn, SHUT_RDWR) == -1) d_errorf("Could not shut down connection %d", m_conn);
+}
 
-    m_shutdown = true;
+int TcpConnection::fd() const noexcept
+{
+    return m_conn;
+}
+
+void TcpConnection::set_nonblocking() noexcept
+{
+    m_nonblocking = true;
+}
+
+void TcpConnection::set_deferred()
+{
+    set_nonblocking();
+    m_deferred = true;
+}
+
+void TcpConnection::append_received(char const* data, size_t size)
+{
+    while (size > 0)
+    {
+        make_room();
+
+        size_t chunk = std::min(size, m_rbuf.size() - m_rend);
+        std::memcpy(m_rbuf.data() + m_rend, data, chunk);
+        m_rend += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+void TcpConnection::batch(bool on) noexcept
+{
+    m_batching = on;
+}
+
+TcpConnection::PendingWrite* TcpConnection::next_pending() noexcept
+{
+    return m_wqueue.empty() ? nullptr : &m_wqueue.front();
+}
+
+void TcpConnection::pop_pending() noexcept
+{
+    if (m_wqueue.front().fd != -1) close(m_wqueue.front().fd);
+    m_wqueue.pop_front();
+}
+
+bool TcpConnection::receive()
+{
+    m_receive_stalled = false;
+
+    while (true)
+    {
+        if (m_rend == m_rbuf.size() && m_rpos == 0 && m_rbuf.size() >= m_rbuf_max)
+        {
+            m_receive_stalled = true;
+            return true;
+        }
+        make_room();
+
+        ssize_t n = read(m_conn, m_rbuf.data() + m_rend, m_rbuf.size() - m_rend);
+        if (n > 0)
+        {
+            m_rend += n;
+        }
+        else if (n == 0)
+        {
+            return false;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return true;
+        }
+        else if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+}
+
+bool TcpConnection::receive_stalled() const noexcept
+{
+    return m_receive_stalled;
+}
+
+char const* TcpConnection::buffered_data() const noexcept
+{
+    return m_rbuf.data() + m_rpos;
+}
+
+size_t TcpConnection::buffered_size() const noexcept
+{
+    return m_rend - m_rpos;
+}
+
+void TcpConnection::consume(size_t size) noexcept
+{
+    m_rpos += std::min(size, m_rend - m_rpos);
+}
+
+bool TcpConnection::read_more()
+{
+    return fill();
+}
+
+HttpParser& TcpConnection::parser() noexcept
+{
+    return m_parser;
+}
+
+BodyDecoder& TcpConnection::body_decoder() noexcept
+{
+    return m_body;
+}
+
+BodySpool& TcpConnection::spool() noexcept
+{
+    return m_spool;
+}
+
+void TcpConnection::reset_body() noexcept
+{
+    m_body.reset();
+    m_spool.clear();
+}
+
+void TcpConnection::erase_buffered(size_t offset, size_t size) noexcept
+{
+    offset = std::min(offset, m_rend - m_rpos);
+    size = std::min(size, m_rend - m_rpos - offset);
+
+    char* at = m_rbuf.data() + m_rpos + offset;
+    std::memmove(at, at + size, m_rend - m_rpos - offset - size);
+    m_rend -= size;
+}
+
+bool TcpConnection::pending_output() const noexcept
+{
+    return !m_wqueue.empty();
+}
+
+size_t TcpConnection::pending_bytes() const noexcept
+{
+    size_t total = 0;
+    for (auto const& pending : m_wqueue)
+    {
+        total += pending.fd == -1 ? pending.bytes().size() - pending.offset : pending.count;
+    }
+    return total;
+}
+
+bool TcpConnection::is_shutdown() const noexcept
+{
+    return m_shutdown;
+}
+
+int TcpConnection::count_request() noexcept
+{
+    return ++m_requests;
+}
+
+int TcpConnection::request_count() const noexcept
+{
+    return m_requests;
+}
+
+void TcpConnection::set_read_deadline(int timeout_ms)
+{
+    m_read_deadline = timeout_ms < 0 ? -1 : TimerWheel::now_ms() + timeout_ms;
+}
+
+std::pmr::memory_resource* TcpConnection::arena() noexcept
+{
+    return &m_arena;
+}
+
+void TcpConnection::reset_arena() noexcept
+{
+    m_arena.release();
+}
+
+bool TcpConnection::wait_readable(int timeout_ms)
+{
+    return m_rpos != m_rend || wait_for(POLLIN | POLLRDHUP, timeout_ms);
+}
+
+bool TcpConnection::wait_for(short events, int timeout_ms)
+{
+    struct pollfd pfd;
+    pfd.fd = m_conn;
+    pfd.events = events;
+
+    int n;
+    while ((n = poll(&pfd, 1, timeout_ms)) == -1)
+    {
+        if (errno != EINTR)
+        {
+            throw ConnectionError("poll");
+        }
+    }
+
+    return n > 0;
+}
+
+void TcpConnection::wait_writable()
+{
+    if (!wait_for(POLLOUT, m_config.write_timeout * 1000))
+    {
+        throw TimeoutError("write timed out");
+    }
+}
+
+void TcpConnection::make_room()
+{
+    if (m_rpos == m_rend)
+    {
+        m_rpos = m_rend = 0;
+    }
+    else if (m_rend == m_rbuf.size())
+    {
+        if (m_rpos > 0)
+        {
+            std::memmove(m_rbuf.data(), m_rbuf.data() + m_rpos, m_rend - m_rpos);
+            m_rend -= m_rpos;
+            m_rpos = 0;
+        }
+        else
+        {
+            m_rbuf.resize(m_rbuf.size() * 2);
+        }
+    }
+}
+
+bool TcpConnection::fill()
+{
+    // a deferred connection only ever sees what the server hands it
+    if (m_deferred)
+    {
+        return false;
+    }
+
+    make_room();
+
+    ssize_t n;
+    while ((n = read(m_conn, m_rbuf.data() + m_rend, m_rbuf.size() - m_rend)) == -1)
+    {
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || m_nonblocking)
+        {
+            return false;
+        }
+
+        // nothing has arrived yet, so wait for it, but no longer than the read deadline allows
+        int timeout = -1;
+        if (m_read_deadline != -1)
+        {
+            timeout = std::max(m_read_deadline - TimerWheel::now_ms(), 0L);
+        }
+        if (!wait_for(POLLIN | POLLRDHUP, timeout))
+        {
+            throw TimeoutError("read timed out");
+        }
+    }
+
+    if (n <= 0)
+    {
+        return false;
+    }
+
+    m_rend += n;
+    return true;
 }
 
 bool TcpConnection::getc(unsigned char* c)
 {
-  return read(m_conn, c, 1) == 1;
+    if (m_rpos == m_rend && !fill())
+    {
+        return false;
+    }
+
+    *c = m_rbuf[m_rpos++];
+    return true;
+}
+
+bool TcpConnection::peek(unsigned char* c)
+{
+    if (m_rpos == m_rend && !fill())
+    {
+        return false;
+    }
+
+    *c = m_rbuf[m_rpos];
+    return true;
+}
+
+bool TcpConnection::read_until(std::string const& delim, std::pmr::string& line, size_t max)
+{
+    line.clear();
+
+    // everything before this offset (relative to m_rpos) is known not to start a match
+    size_t scanned = 0;
+
+    while (true)
+    {
+        char const* begin = m_rbuf.data() + m_rpos;
+        char const* end = m_rbuf.data() + m_rend;
+        char const* found = std::search(begin + scanned, end, delim.begin(), delim.end());
+        size_t available = m_rend - m_rpos;
+
+        if (found != end && (size_t) (found - begin) + delim.size() <= max)
+        {
+            size_t length = found - begin + delim.size();
+            line.append(begin, length);
+            m_rpos += length;
+            return true;
+        }
+
+        if (available >= max)
+        {
+            line.append(begin, max);
+            m_rpos += max;
+            return true;
+        }
+
+        scanned = available >= delim.size() ? available - delim.size() + 1 : 0;
+
+        if (!fill())
+        {
+            return false;
+        }
+    }
+}
+
+bool TcpConnection::read_exact(void* buf, size_t bufsize)
+{
+    char* out = (char*) buf;
 
-  //throw TodoError("2", "You have to implement reading from connections");
+    while (bufsize > 0)
+    {
+        if (m_rpos == m_rend && !fill())
+        {
+            return false;
+        }
+
+        size_t chunk = std::min(bufsize, m_rend - m_rpos);
+        std::memcpy(out, m_rbuf.data() + m_rpos, chunk);
+        m_rpos += chunk;
+        out += chunk;
+        bufsize -= chunk;
+    }
+
+    return true;
 }
 
 void TcpConnection::putc(unsigned char c)
 {
-  write(m_conn, &c, 1);
-  //throw TodoError("2", "You need to implement writing characters to connections");
+    putbuf(&c, 1);
 }
 
-void TcpConnection::puts(std::string const& str)
+void TcpConnection::puts(std::string_view str)
 {
-  write(m_conn, str.c_str(), str.length());
-  //throw TodoError("2", "You need to implement writing strings to connections");
+    putbuf(str.data(), str.length());
 }
 
 void TcpConnection::putbuf(void const* buf, size_t bufsize)
 {
-  write(m_conn, buf, bufsize);
-  //throw TodoError("2", "You need to implement writing buffers to connections");
+    struct iovec iov;
+    iov.iov_base = (void*) buf;
+    iov.iov_len = bufsize;
+    putv(&iov, 1);
+}
+
+void TcpConnection::putv(struct iovec* iov, int iovcnt)
+{
+    // anything written now would overtake what is already queued
+    if (m_deferred || m_batching || !m_wqueue.empty())
+    {
+        queue(iov, iovcnt);
+        return;
+    }
+
+    while (iovcnt > 0)
+    {
+        // skip over anything that has already been written completely
+        if (iov->iov_len == 0)
+        {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+
+        ssize_t n = writev(m_conn, iov, std::min(iovcnt, IOV_MAX));
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (m_nonblocking)
+                {
+                    queue(iov, iovcnt);
+                    return;
+                }
+                wait_writable();
+                continue;
+            }
+            throw ConnectionError("writev");
+        }
+
+        size_t written = n;
+        while (iovcnt > 0 && written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char*) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+void TcpConnection::putref(std::shared_ptr<void const> keep, void const* buf, size_t size)
+{
+    char const* at = (char const*) buf;
+
+    if (!m_deferred && !m_batching && m_wqueue.empty())
+    {
+        while (size > 0)
+        {
+            ssize_t n = write(m_conn, at, size);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if (m_nonblocking)
+                    {
+                        break;
+                    }
+                    wait_writable();
+                    continue;
+                }
+                throw ConnectionError("write");
+            }
+
+            at += n;
+            size -= n;
+        }
+    }
+
+    if (size > 0)
+    {
+        queue_ref(std::move(keep), at, size);
+    }
+}
+
+void TcpConnection::sendfile(int fd, off_t offset, size_t count)
+{
+    if (m_deferred || m_batching || !m_wqueue.empty())
+    {
+        queue_file(fd, offset, count);
+        return;
+    }
+
+    while (count > 0)
+    {
+        ssize_t n = ::sendfile(m_conn, fd, &offset, count);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (m_nonblocking)
+                {
+                    queue_file(fd, offset, count);
+                    return;
+                }
+                wait_writable();
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS)
+            {
+                // fd is not something sendfile() can read from, so copy it by hand
+                break;
+            }
+            throw ConnectionError("sendfile");
+        }
+        if (n == 0)
+        {
+            // the file got shorter since the caller sized it
+            throw ConnectionError("sendfile: unexpected end of file");
+        }
+
+        // sendfile() has moved offset along already
+        count -= n;
+    }
+
+    char buf[16384];
+    while (count > 0)
+    {
+        ssize_t n = pread(fd, buf, std::min(count, sizeof(buf)), offset);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            throw ConnectionError("pread");
+        }
+
+        putbuf(buf, n);
+        offset += n;
+        count -= n;
+    }
+}
+
+void TcpConnection::cork(bool on)
+{
+    // deferred and batched output is written long after this is called, flush() corks for itself
+    if (m_deferred || m_batching)
+    {
+        return;
+    }
+
+    setcork(on);
+}
+
+void TcpConnection::setcork(bool on)
+{
+    int optval = on ? 1 : 0;
+    if (setsockopt(m_conn, IPPROTO_TCP, TCP_CORK, &optval, sizeof(optval)) == -1)
+    {
+        d_warnf("Could not set TCP_CORK on connection %d", m_conn);
+    }
+}
+
+void TcpConnection::queue(struct iovec const* iov, int iovcnt)
+{
+    if (m_wqueue.empty() || m_wqueue.back().fd != -1 || m_wqueue.back().keep != nullptr)
+    {
+        PendingWrite pending;
+        pending.fd = -1;
+        pending.offset = 0;
+        pending.count = 0;
+        m_wqueue.push_back(pending);
+    }
+
+    // one allocation for the whole write rather than one per buffer, still growing
+    // geometrically while a batch of pipelined responses piles up in the same entry
+    std::string& data = m_wqueue.back().data;
+    size_t total = data.size();
+    for (int i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].iov_len;
+    }
+    if (total > data.capacity())
+    {
+        data.reserve(std::max(total, 2 * data.capacity()));
+    }
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        data.append((char const*) iov[i].iov_base, iov[i].iov_len);
+    }
+}
+
+void TcpConnection::queue_file(int fd, off_t offset, size_t count)
+{
+    PendingWrite pending;
+    pending.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    pending.offset = offset;
+    pending.count = count;
+
+    if (pending.fd == -1)
+    {
+        throw ConnectionError("dup");
+    }
+
+    m_wqueue.push_back(pending);
+}
+
+void TcpConnection::queue_ref(std::shared_ptr<void const> keep, char const* buf, size_t size)
+{
+    PendingWrite pending;
+    pending.keep = std::move(keep);
+    pending.shared = std::string_view(buf, size);
+    pending.fd = -1;
+    pending.offset = 0;
+    pending.count = 0;
+    m_wqueue.push_back(std::move(pending));
+}
+
+bool TcpConnection::flush()
+{
+    // keep a batch of responses (and headers in front of a file) from going out in small packets
+    bool corked = m_wqueue.size() > 1 && !m_deferred;
+    if (corked)
+    {
+        setcork(true);
+    }
+
+    while (!m_wqueue.empty())
+    {
+        PendingWrite& pending = m_wqueue.front();
+        ssize_t n;
+
+        if (pending.fd == -1)
+        {
+            std::string_view bytes = pending.bytes();
+            n = write(m_conn, bytes.data() + pending.offset, bytes.size() - pending.offset);
+        }
+        else
+        {
+            n = ::sendfile(m_conn, pending.fd, &pending.offset, pending.count);
+        }
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (!m_nonblocking)
+                {
+                    wait_writable();
+                    continue;
+                }
+                if (corked) setcork(false);
+                return false;
+            }
+            throw ConnectionError("flush");
+        }
+
+        if (pending.fd == -1)
+        {
+            pending.offset += n;
+            if ((size_t) pending.offset < pending.bytes().size()) continue;
+        }
+        else
+        {
+            if (n == 0)
+            {
+                throw ConnectionError("sendfile: unexpected end of file");
+            }
+            pending.count -= n;
+            if (pending.count > 0) continue;
+            close(pending.fd);
+        }
+
+        m_wqueue.pop_front();
+    }
+
+    if (corked)
+    {
+        setcork(false);
+    }
+
+    if (m_shutdown_pending)
+    {
+        m_shutdown_pending = false;
+        shutdown();
+    }
+
+    return true;
 }
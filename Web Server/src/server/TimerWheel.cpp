@@ -0,0 +1,118 @@
+#include <time.h>
+#include <algorithm>
+
+#include "server/TimerWheel.hpp"
+
+TimerWheel::Timer::Timer() noexcept :
+    data(nullptr),
+    m_prev(this),
+    m_next(this),
+    m_wheel(nullptr),
+    m_expires(0)
+{
+
+}
+
+TimerWheel::Timer::~Timer() noexcept
+{
+    cancel();
+}
+
+bool TimerWheel::Timer::armed() const noexcept
+{
+    return m_next != this;
+}
+
+void TimerWheel::Timer::cancel() noexcept
+{
+    if (!armed())
+    {
+        return;
+    }
+
+    m_prev->m_next = m_next;
+    m_next->m_prev = m_prev;
+    m_prev = m_next = this;
+
+    // only sentinels are linked without a wheel
+    if (m_wheel != nullptr)
+    {
+        m_wheel->m_armed--;
+        m_wheel = nullptr;
+    }
+}
+
+TimerWheel::TimerWheel(int tick_ms, size_t slots) :
+    m_tick_ms(tick_ms),
+    m_slots(slots),
+    m_wheel(new Timer[slots]),
+    m_last_tick(now_ms() / tick_ms),
+    m_armed(0)
+{
+
+}
+
+void TimerWheel::schedule(Timer& timer, int timeout_ms)
+{
+    timer.cancel();
+
+    timer.m_expires = now_ms() + timeout_ms;
+
+    // Rounding up means a slot is only looked at once all of its timers for this turn
+    // are due, and a timer never goes into a slot that has already been looked at.
+    long tick = std::max((timer.m_expires + m_tick_ms - 1) / m_tick_ms, m_last_tick + 1);
+    Timer& slot = m_wheel[tick % m_slots];
+
+    timer.m_prev = slot.m_prev;
+    timer.m_next = &slot;
+    slot.m_prev->m_next = &timer;
+    slot.m_prev = &timer;
+    timer.m_wheel = this;
+    m_armed++;
+}
+
+int TimerWheel::next_timeout_ms() const noexcept
+{
+    if (m_armed == 0)
+    {
+        return -1;
+    }
+
+    long wait = (m_last_tick + 1) * m_tick_ms - now_ms();
+    return wait > 0 ? (int) wait : 0;
+}
+
+void TimerWheel::expire(std::vector<Timer*>& expired)
+{
+    long now = now_ms();
+    long tick = now / m_tick_ms;
+
+    // after a long stall every slot gets looked at once
+    long first = std::max(m_last_tick + 1, tick - (long) m_slots + 1);
+
+    for (long t = first; t <= tick; t++)
+    {
+        Timer& slot = m_wheel[t % m_slots];
+        Timer* timer = slot.m_next;
+
+        while (timer != &slot)
+        {
+            Timer* next = timer->m_next;
+            if (timer->m_expires <= now)
+            {
+                timer->cancel();
+                expired.push_back(timer);
+            }
+            timer = next;
+        }
+    }
+
+    m_last_tick = std::max(m_last_tick, tick);
+}
+
+long TimerWheel::now_ms() noexcept
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
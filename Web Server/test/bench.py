@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+bench.py [-e http_executable] [-c clients] [-d seconds] [-r route] [-p depth] [mode...]
+
+Starts the server once per mode and measures requests per second against it.
+Each of the clients processes sends depth requests at a time (pipelined when
+depth is more than 1) and reuses its connection for as long as the server
+keeps it open.
+Modes are given as the server's own flags, for example "-L" or "-P 4";
+without any, every blocking mode is compared against --event-loop and --io-uring.
+"""
+
+import argparse
+import multiprocessing
+import socket
+import subprocess
+import sys
+import time
+
+DEFAULT_MODES = ["-L", "-F", "-R", "-P 4", "--event-loop", "--io-uring"]
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(("127.0.0.1", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def read_response(sock, pending):
+    """Reads one response and returns (leftover bytes, whether the server keeps the connection)."""
+    while b"\r\n\r\n" not in pending:
+        data = sock.recv(65536)
+        if not data:
+            raise ConnectionError("connection closed before headers")
+        pending += data
+
+    head, _, rest = pending.partition(b"\r\n\r\n")
+    length = 0
+    keep_alive = head.startswith(b"HTTP/1.1")
+    for line in head.split(b"\r\n")[1:]:
+        key, _, value = line.partition(b":")
+        key = key.strip().lower()
+        if key == b"content-length":
+            length = int(value)
+        elif key == b"connection":
+            keep_alive = value.strip().lower() == b"keep-alive"
+
+    while len(rest) < length:
+        data = sock.recv(65536)
+        if not data:
+            raise ConnectionError("connection closed before body")
+        rest += data
+
+    return rest[length:], keep_alive
+
+
+def client(port, route, depth, deadline, results):
+    request = ("GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n" % route).encode() * depth
+    done = 0
+    errors = 0
+    sock = None
+    pending = b""
+
+    while time.time() < deadline:
+        try:
+            if sock is None:
+                sock = socket.create_connection(("127.0.0.1", port))
+                pending = b""
+            sock.sendall(request)
+            keep_alive = True
+            for _ in range(depth):
+                pending, keep_alive = read_response(sock, pending)
+                done += 1
+                if not keep_alive:
+                    break
+            if not keep_alive:
+                sock.close()
+                sock = None
+        except OSError:
+            errors += 1
+            if sock is not None:
+                sock.close()
+            sock = None
+
+    results.put((done, errors))
+
+
+def bench(http, mode, clients, seconds, route, depth):
+    port = free_port()
+    server = subprocess.Popen([http, "--port", str(port)] + mode.split(),
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    time.sleep(0.3)
+
+    if server.poll() is not None:
+        return None
+
+    results = multiprocessing.Queue()
+    deadline = time.time() + seconds
+    procs = [multiprocessing.Process(target=client, args=(port, route, depth, deadline, results))
+             for _ in range(clients)]
+    for p in procs:
+        p.start()
+
+    done = 0
+    errors = 0
+    for _ in procs:
+        d, e = results.get()
+        done += d
+        errors += e
+    for p in procs:
+        p.join()
+
+    server.kill()
+    server.wait()
+    return done / seconds, errors
+
+
+def main():
+    parser = argparse.ArgumentParser(usage=__doc__)
+    parser.add_argument("-e", "--executable", default="bin/http")
+    parser.add_argument("-c", "--clients", type=int, default=8)
+    parser.add_argument("-d", "--duration", type=float, default=3.0)
+    parser.add_argument("-r", "--route", default="/hello-world")
+    parser.add_argument("-p", "--pipeline", type=int, default=1)
+    parser.add_argument("modes", nargs="*")
+    args, extra = parser.parse_known_args()
+
+    # lets modes like "-L" through without quoting
+    modes = args.modes + extra or DEFAULT_MODES
+
+    print("%-20s %12s %8s" % ("mode", "requests/s", "errors"))
+    for mode in modes:
+        result = bench(args.executable, mode, args.clients, args.duration, args.route, args.pipeline)
+        if result is None:
+            print("%-20s %12s" % (mode, "did not start"))
+        else:
+            print("%-20s %12.0f %8d" % (mode, result[0], result[1]))
+
+
+if __name__ == "__main__":
+    main()
@@ -12,6 +12,10 @@ cmpflag=$7
 
 nc $host $port < $reqfile > $outfile 2>&1
 
+# ETags depend on whether the server had the file cached (a strong one from its contents) or not
+# (a weak one from its size and modification time), so any well-formed one passes for <etag>
+sed -i -E '1,/^\r$/ s/^ETag: (W\/)?"[0-9a-f-]+"\r$/ETag: <etag>\r/' $outfile
+
 if [[ "$cmpflag" = "--use-cmp" ]]; then
     cmp --print-bytes --verbose $outfile $resfile > $cmpfile 2>&1
 else
@@ -15,9 +15,10 @@ verbose=$3
 
 printf "GET /hello-world HTTP/1.1\r\n" > $reqfile
 printf "Accept: */*\r\n" >> $reqfile
+printf "Connection: close\r\n" >> $reqfile
 printf "\r\n" >> $reqfile
 
-printf "HTTP/1.0 200 OK\r\n" > $resfile
+printf "HTTP/1.1 200 OK\r\n" > $resfile
 printf "Connection: close\r\n" >> $resfile
 printf "Content-Length: 13\r\n" >> $resfile
 printf "Content-Type: text/plain\r\n" >> $resfile
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+set -e
+
+# get the name and path of the current file except for the .sh extension
+testcase=${0%\.*}
+reqfile="$testcase.req"
+resfile="$testcase.org.res"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+host=$1
+port=$2
+verbose=$3
+
+# the connection stays open, so the chunked body has to be decoded to its end before the
+# second request can be read
+printf "POST /hello-world HTTP/1.1\r\n" > $reqfile
+printf "Transfer-Encoding: chunked\r\n" >> $reqfile
+printf "\r\n" >> $reqfile
+printf "5\r\nhello\r\n6;note=x\r\n world\r\n0\r\n\r\n" >> $reqfile
+printf "GET /hello-world HTTP/1.1\r\n" >> $reqfile
+printf "Connection: close\r\n" >> $reqfile
+printf "\r\n" >> $reqfile
+
+printf "HTTP/1.1 200 OK\r\n" > $resfile
+printf "Connection: keep-alive\r\n" >> $resfile
+printf "Content-Length: 13\r\n" >> $resfile
+printf "Content-Type: text/plain\r\n" >> $resfile
+printf "\r\n" >> $resfile
+printf "Hello world!\n" >> $resfile
+printf "HTTP/1.1 200 OK\r\n" >> $resfile
+printf "Connection: close\r\n" >> $resfile
+printf "Content-Length: 13\r\n" >> $resfile
+printf "Content-Type: text/plain\r\n" >> $resfile
+printf "\r\n" >> $resfile
+printf "Hello world!\n" >> $resfile
+
+$(dirname $0)/run-http-test.sh $host $port $reqfile $resfile $outfile $cmpfile
+success=$?
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $reqfile $resfile $outfile
+    if [[ "$success" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $success
@@ -0,0 +1,92 @@
+#!/bin/bash
+
+testcase=${0%\.*}
+serverout="$testcase.server.out"
+reqfile="$testcase.req"
+resfile="$testcase.org.res"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+http="bin/http"
+if [[ "$1" = "-e" ]]; then
+    http="$2"
+    shift
+    shift
+fi
+
+verbose="$1"
+
+$http -W 3 > $serverout 2>&1 &
+server_pid=$!
+
+sleep 0.2
+
+isalive=$(ps -u $USER | grep $server_pid | uniq | wc -l)
+
+if [[ $isalive != "1" ]]; then
+    echo "Could not start server" > $cmpfile
+    exit 1
+fi
+
+port=$(get-port.sh $server_pid)
+
+ret=0
+
+# the supervisor should have forked exactly three workers
+workers=$(ps -o pid= --ppid $server_pid | wc -l)
+if [[ $workers != "3" ]]; then
+    echo "Expected 3 workers; got $workers" > $cmpfile
+    ret=1
+fi
+
+# a worker that dies gets replaced
+victim=$(ps -o pid= --ppid $server_pid | head -n 1)
+kill -SIGKILL $victim
+
+sleep 1.5
+
+workers=$(ps -o pid= --ppid $server_pid | wc -l)
+if [[ $workers != "3" ]]; then
+    echo "Expected 3 workers after killing one; got $workers" >> $cmpfile
+    ret=1
+fi
+
+printf "GET /hello-world HTTP/1.0\r\n" > $reqfile
+printf "\r\n" >> $reqfile
+
+printf "HTTP/1.0 200 OK\r\n" > $resfile
+printf "Connection: close\r\n" >> $resfile
+printf "Content-Length: 13\r\n" >> $resfile
+printf "Content-Type: text/plain\r\n" >> $resfile
+printf "\r\n" >> $resfile
+printf "Hello world!\n" >> $resfile
+
+timeout 2 nc 127.0.0.1 $port < $reqfile > $outfile 2>&1
+
+if ! diff -u $outfile $resfile >> $cmpfile 2>&1; then
+    ret=1
+fi
+
+workers=$(ps -o pid= --ppid $server_pid)
+
+kill -SIGKILL $server_pid
+wait $server_pid 2> /dev/null
+sleep 0.2
+
+# and the workers go down with the supervisor (a zombie waiting for init to reap it is gone too)
+for pid in $workers; do
+    if ps -o stat= -p $pid | grep -qv Z; then
+        echo "Worker $pid outlived the supervisor" >> $cmpfile
+        kill -SIGKILL $pid
+        ret=1
+    fi
+done
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $serverout $reqfile $resfile $outfile
+    if [[ "$ret" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $ret
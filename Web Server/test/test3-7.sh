@@ -0,0 +1,72 @@
+#!/bin/bash
+
+testcase=${0%\.*}
+serverout="$testcase.server.out"
+reqfile="$testcase.req"
+resfile="$testcase.org.res"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+http="bin/http"
+if [[ "$1" = "-e" ]]; then
+    http="$2"
+    shift
+    shift
+fi
+
+verbose="$1"
+
+$http -W 2 --handoff > $serverout 2>&1 &
+server_pid=$!
+
+sleep 0.2
+
+isalive=$(ps -u $USER | grep $server_pid | uniq | wc -l)
+
+if [[ $isalive != "1" ]]; then
+    echo "Could not start server" > $cmpfile
+    exit 1
+fi
+
+port=$(get-port.sh $server_pid)
+
+# a connection that never sends anything keeps one of the two workers busy
+nc 127.0.0.1 $port &
+nc1=$!
+
+sleep 0.2
+
+printf "GET /hello-world HTTP/1.0\r\n" > $reqfile
+printf "\r\n" >> $reqfile
+
+printf "HTTP/1.0 200 OK\r\n" > $resfile
+printf "Connection: close\r\n" >> $resfile
+printf "Content-Length: 13\r\n" >> $resfile
+printf "Content-Type: text/plain\r\n" >> $resfile
+printf "\r\n" >> $resfile
+printf "Hello world!\n" >> $resfile
+
+# every request should go to the idle worker rather than wait behind the silent client
+ret=0
+for i in 1 2 3 4; do
+    timeout 2 nc 127.0.0.1 $port < $reqfile > $outfile 2>&1
+
+    if ! diff -u $outfile $resfile >> $cmpfile 2>&1; then
+        ret=1
+    fi
+done
+
+for pid in $nc1 $server_pid; do
+    kill -SIGKILL $pid
+    wait $pid 2> /dev/null
+    sleep 0.1
+done
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $serverout $reqfile $resfile $outfile
+    if [[ "$ret" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $ret
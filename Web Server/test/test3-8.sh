@@ -0,0 +1,78 @@
+#!/bin/bash
+
+testcase=${0%\.*}
+serverout="$testcase.server.out"
+reqfile="$testcase.req"
+resfile="$testcase.org.res"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+http="bin/http"
+if [[ "$1" = "-e" ]]; then
+    http="$2"
+    shift
+    shift
+fi
+
+verbose="$1"
+
+# a file far larger than the socket buffers, in a directory of its own
+staticdir=$(mktemp -d)
+head -c 20000000 /dev/urandom > $staticdir/large.bin
+
+# without the file cache and mappings the file goes out with sendfile(), which keeps stopping
+# part way whenever the reader falls behind. Both the blocking and the event loop code paths
+# have to pick up where it stopped
+ret=0
+: > $cmpfile
+for mode in --linear --event-loop; do
+    $http $mode --static-dir $staticdir --file-cache-size 0 --mmap-files 0 > $serverout 2>&1 &
+    server_pid=$!
+
+    sleep 0.2
+
+    isalive=$(ps -u $USER | grep $server_pid | uniq | wc -l)
+
+    if [[ $isalive != "1" ]]; then
+        echo "Could not start server" > $cmpfile
+        rm -rf $staticdir
+        exit 1
+    fi
+
+    port=$(get-port.sh $server_pid)
+
+    printf "GET /large.bin HTTP/1.0\r\n" > $reqfile
+    printf "\r\n" >> $reqfile
+
+    printf "HTTP/1.0 200 OK\r\n" > $resfile
+    printf "Connection: close\r\n" >> $resfile
+    printf "Content-Length: 20000000\r\n" >> $resfile
+    printf "Content-Type: application/octet-stream\r\n" >> $resfile
+    printf "ETag: <etag>\r\n" >> $resfile
+    printf "Last-Modified: %s\r\n" "$(LC_ALL=C date -u -r $staticdir/large.bin '+%a, %d %b %Y %H:%M:%S GMT')" >> $resfile
+    printf "\r\n" >> $resfile
+    cat $staticdir/large.bin >> $resfile
+
+    # the reader does not start reading for a while, so the server has to wait for it
+    timeout 20 nc 127.0.0.1 $port < $reqfile | (sleep 2; cat) > $outfile
+    sed -i -E '1,/^\r$/ s/^ETag: (W\/)?"[0-9a-f-]+"\r$/ETag: <etag>\r/' $outfile
+
+    if ! cmp $outfile $resfile >> $cmpfile 2>&1; then
+        echo "$mode: expected $(stat -c %s $resfile) bytes, got $(stat -c %s $outfile)" >> $cmpfile
+        ret=1
+    fi
+
+    kill -SIGKILL $server_pid
+    wait $server_pid 2> /dev/null
+done
+
+rm -rf $staticdir
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $serverout $reqfile $resfile $outfile
+    if [[ "$ret" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $ret
@@ -0,0 +1,93 @@
+#!/bin/bash
+
+testcase=${0%\.*}
+serverout="$testcase.server.out"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+http="bin/http"
+if [[ "$1" = "-e" ]]; then
+    http="$2"
+    shift
+    shift
+fi
+
+verbose="$1"
+
+# one script that takes a while and one that never finishes, in a directory of their own
+execdir=$(mktemp -d)
+printf 'sleep 2\nprintf "HTTP/1.0 200 OK\\r\\nContent-Length: 5\\r\\n\\r\\nslept"\n' > $execdir/slow.sh
+printf 'sleep 60\n' > $execdir/stuck.sh
+chmod +x $execdir/*.sh
+
+function now_ms {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# the event loops run scripts on threads of their own, so they keep answering everyone else
+# in the meantime, and a script that runs past the write timeout is killed
+ret=0
+: > $cmpfile
+for mode in --event-loop --io-uring; do
+    $http $mode --exec-dir $execdir --write-timeout 4 > $serverout 2>&1 &
+    server_pid=$!
+
+    sleep 0.2
+
+    isalive=$(ps -u $USER | grep $server_pid | uniq | wc -l)
+
+    if [[ $isalive != "1" ]]; then
+        echo "Could not start server" > $cmpfile
+        rm -rf $execdir
+        exit 1
+    fi
+
+    port=$(get-port.sh $server_pid)
+
+    start=$(now_ms)
+    printf "GET /script/slow.sh HTTP/1.0\r\n\r\n" | timeout 10 nc 127.0.0.1 $port > $outfile.slow &
+    slow_pid=$!
+    printf "GET /script/stuck.sh HTTP/1.0\r\n\r\n" | timeout 10 nc 127.0.0.1 $port > $outfile.stuck &
+    stuck_pid=$!
+
+    sleep 0.5
+    hello=$(printf "GET /hello-world HTTP/1.0\r\n\r\n" | timeout 10 nc 127.0.0.1 $port | head -n 1)
+    hello_ms=$(( $(now_ms) - start ))
+    if [[ "$hello" != $'HTTP/1.0 200 OK\r' || $hello_ms -gt 1500 ]]; then
+        echo "$mode: /hello-world was answered with '$hello' after ${hello_ms}ms while scripts were running" >> $cmpfile
+        ret=1
+    fi
+
+    wait $slow_pid
+    if [[ "$(head -n 1 $outfile.slow)" != $'HTTP/1.0 200 OK\r' || "$(tail -c 5 $outfile.slow)" != "slept" ]]; then
+        echo "$mode: /script/slow.sh was not answered with what it wrote" >> $cmpfile
+        ret=1
+    fi
+
+    wait $stuck_pid
+    stuck_ms=$(( $(now_ms) - start ))
+    if [[ "$(head -n 1 $outfile.stuck)" != $'HTTP/1.0 500 Internal Server Error\r' || $stuck_ms -gt 8000 ]]; then
+        echo "$mode: /script/stuck.sh got '$(head -n 1 $outfile.stuck)' after ${stuck_ms}ms instead of a 500 after the write timeout" >> $cmpfile
+        ret=1
+    fi
+
+    kill -SIGKILL $server_pid
+    wait $server_pid 2> /dev/null
+done
+
+if pgrep -f "^sleep 60$" > /dev/null; then
+    echo "The script that was killed left processes behind" >> $cmpfile
+    pkill -f "^sleep 60$"
+    ret=1
+fi
+
+rm -rf $execdir
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $serverout $outfile.slow $outfile.stuck
+    if [[ "$ret" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $ret
@@ -20,6 +20,8 @@ printf "HTTP/1.0 200 OK\r\n" > $resfile
 printf "Connection: close\r\n" >> $resfile
 printf "Content-Length: 8162\r\n" >> $resfile
 printf "Content-Type: text/html\r\n" >> $resfile
+printf "ETag: <etag>\r\n" >> $resfile
+printf "Last-Modified: %s\r\n" "$(LC_ALL=C date -u -r $root/static/index.html '+%a, %d %b %Y %H:%M:%S GMT')" >> $resfile
 printf "\r\n" >> $resfile
 cat $root/static/index.html >> $resfile
 
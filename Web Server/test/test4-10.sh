@@ -0,0 +1,37 @@
+#!/bin/bash
+
+root=$(git rev-parse --show-toplevel)
+
+# get the name and path of the current file except for the .sh extension
+testcase=${0%\.*}
+reqfile="$testcase.req"
+resfile="$testcase.org.res"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+host=$1
+port=$2
+verbose=$3
+
+printf "HEAD /images/pic01.jpg HTTP/1.0\r\n" > $reqfile
+printf "\r\n" >> $reqfile
+
+printf "HTTP/1.0 200 OK\r\n" > $resfile
+printf "Connection: close\r\n" >> $resfile
+printf "Content-Length: 6311\r\n" >> $resfile
+printf "Content-Type: image/jpeg\r\n" >> $resfile
+printf "ETag: <etag>\r\n" >> $resfile
+printf "Last-Modified: %s\r\n" "$(LC_ALL=C date -u -r $root/static/images/pic01.jpg '+%a, %d %b %Y %H:%M:%S GMT')" >> $resfile
+printf "\r\n" >> $resfile
+
+$(dirname $0)/run-http-test.sh $host $port $reqfile $resfile $outfile $cmpfile
+success=$?
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $reqfile $resfile $outfile
+    if [[ "$success" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $success
@@ -20,6 +20,8 @@ printf "HTTP/1.0 200 OK\r\n" > $resfile
 printf "Connection: close\r\n" >> $resfile
 printf "Content-Length: 6311\r\n" >> $resfile
 printf "Content-Type: image/jpeg\r\n" >> $resfile
+printf "ETag: <etag>\r\n" >> $resfile
+printf "Last-Modified: %s\r\n" "$(LC_ALL=C date -u -r $root/static/images/pic01.jpg '+%a, %d %b %Y %H:%M:%S GMT')" >> $resfile
 printf "\r\n" >> $resfile
 cat $root/static/images/pic01.jpg >> $resfile
 
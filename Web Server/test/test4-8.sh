@@ -0,0 +1,39 @@
+#!/bin/bash
+
+root=$(git rev-parse --show-toplevel)
+
+# get the name and path of the current file except for the .sh extension
+testcase=${0%\.*}
+reqfile="$testcase.req"
+resfile="$testcase.org.res"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+host=$1
+port=$2
+verbose=$3
+
+# whatever ETag the server hands out for the file has to be good for a 304 afterwards
+etag=$(printf "GET /index.html HTTP/1.0\r\n\r\n" | nc $host $port 2>/dev/null | sed -n 's/^ETag: \(.*\)\r$/\1/p')
+
+printf "GET /index.html HTTP/1.0\r\n" > $reqfile
+printf "If-None-Match: \"nope\", %s\r\n" "$etag" >> $reqfile
+printf "\r\n" >> $reqfile
+
+printf "HTTP/1.0 304 Not Modified\r\n" > $resfile
+printf "Connection: close\r\n" >> $resfile
+printf "ETag: <etag>\r\n" >> $resfile
+printf "Last-Modified: %s\r\n" "$(LC_ALL=C date -u -r $root/static/index.html '+%a, %d %b %Y %H:%M:%S GMT')" >> $resfile
+printf "\r\n" >> $resfile
+
+$(dirname $0)/run-http-test.sh $host $port $reqfile $resfile $outfile $cmpfile
+success=$?
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $reqfile $resfile $outfile
+    if [[ "$success" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $success
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+root=$(git rev-parse --show-toplevel)
+
+# get the name and path of the current file except for the .sh extension
+testcase=${0%\.*}
+reqfile="$testcase.req"
+resfile="$testcase.org.res"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+host=$1
+port=$2
+verbose=$3
+
+modified=$(LC_ALL=C date -u -r $root/static/generic.html '+%a, %d %b %Y %H:%M:%S GMT')
+
+printf "GET /generic.html HTTP/1.0\r\n" > $reqfile
+printf "If-Modified-Since: %s\r\n" "$modified" >> $reqfile
+printf "\r\n" >> $reqfile
+
+printf "HTTP/1.0 304 Not Modified\r\n" > $resfile
+printf "Connection: close\r\n" >> $resfile
+printf "ETag: <etag>\r\n" >> $resfile
+printf "Last-Modified: %s\r\n" "$modified" >> $resfile
+printf "\r\n" >> $resfile
+
+$(dirname $0)/run-http-test.sh $host $port $reqfile $resfile $outfile $cmpfile
+success=$?
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $reqfile $resfile $outfile
+    if [[ "$success" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $success
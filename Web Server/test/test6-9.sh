@@ -0,0 +1,56 @@
+#!/bin/bash
+# get the name and path of the current file except for the .sh extension
+testcase=${0%\.*}
+reqfile="$testcase.req"
+resfile="$testcase.org.res"
+outfile="$testcase.out.res"
+cmpfile="$testcase.cmp"
+
+host=$1
+port=$2
+verbose=$3
+
+body=$(printf -- '--xyz\r\nContent-Disposition: form-data; name="doc"; filename="hello.txt"\r\nContent-Type: text/plain\r\n\r\nHello upload!\n\r\n--xyz--\r\n'; echo x)
+body=${body%x}
+
+printf "POST /script/upload.sh HTTP/1.0\r\n" > $reqfile
+printf "Content-Length: ${#body}\r\n" >> $reqfile
+printf "Content-Type: multipart/form-data; boundary=xyz\r\n" >> $reqfile
+printf "\r\n" >> $reqfile
+printf "%s" "$body" >> $reqfile
+
+printf "HTTP/1.0 200 OK\r\n" > $resfile
+printf "Connection: close\r\n" >> $resfile
+printf "Content-Length: 18\r\n" >> $resfile
+printf "Content-Type: text/plain\r\n" >> $resfile
+printf "X-Upload-Paths: <path> \r\n" >> $resfile
+printf "\r\n" >> $resfile
+printf "doc\nHello upload!\n" >> $resfile
+
+nc $host $port < $reqfile > $outfile 2>&1
+
+# the script saw the file while it ran, and the server removes it once the request is done
+path=$(sed -n -E 's/^X-Upload-Paths: ([^ ]*) \r$/\1/p' $outfile)
+sed -i -E 's/^X-Upload-Paths: [^ ]+ \r$/X-Upload-Paths: <path> \r/' $outfile
+diff -u $outfile $resfile > $cmpfile 2>&1
+success=$?
+
+for i in $(seq 20); do
+    if [[ -n "$path" && ! -e "$path" ]]; then
+        break
+    fi
+    sleep 0.1
+done
+if [[ -z "$path" || -e "$path" ]]; then
+    echo "Uploaded file '$path' was not removed" >> $cmpfile
+    success=1
+fi
+
+if [[ "$verbose" != "-v" ]]; then
+    rm -f $reqfile $resfile $outfile
+    if [[ "$success" = "0" ]]; then
+        rm -f $cmpfile
+    fi
+fi
+
+exit $success